@@ -0,0 +1,81 @@
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+// Maximum number of times barrier_wait() polls the generation before sleeping.
+#define BARRIER_SPIN 20000
+
+int
+barrier_init(barrier_t *barrier, int n)
+{
+    if(n <= 0)
+        return -1;
+    barrier->n = n;
+    barrier->count = 0;
+    barrier->generation = 0;
+    return 0;
+}
+
+// Count the LWPs of the caller's address space, other than the caller,
+// that are running on a CPU. The ptable lock must be held.
+static int
+running_lwps1(void)
+{
+    struct proc *p, *curproc = myproc();
+    int n = 0;
+
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if(p != curproc && p->state == RUNNING && p->pgdir == curproc->pgdir)
+            n++;
+    return n;
+}
+
+// Wait until n LWPs have called barrier_wait().
+// The last LWP to arrive opens the barrier and wakes everyone with a single
+// pass over the process table. It returns 1, every other LWP returns 0.
+// If all the LWPs that have not arrived yet are running, the end of the
+// phase is near, so waiters spin for a while before going to sleep.
+int
+barrier_wait(barrier_t *barrier)
+{
+    struct proc *p = myproc();
+    uint generation;
+    int i, spin;
+
+    acquire(&ptable.lock);
+    generation = barrier->generation;
+    if(++barrier->count >= barrier->n) {
+        barrier->count = 0;
+        barrier->generation++;
+        wakeupq1(barrier, p->pgdir, NPROC);
+        release(&ptable.lock);
+        return 1;
+    }
+    spin = (barrier->n - barrier->count) <= running_lwps1();
+
+    if(spin) {
+        release(&ptable.lock);
+        for(i = 0; i < BARRIER_SPIN && barrier->generation == generation; i++)
+            pause();
+        if(barrier->generation != generation)
+            return 0;
+        acquire(&ptable.lock);
+    }
+
+    // Each waiter holds the same ticket: the whole queue is released at once.
+    while(barrier->generation == generation && !p->killed)
+        sleepq(barrier, &ptable.lock, 1, 0);
+    release(&ptable.lock);
+
+    return p->killed ? -1 : 0;
+}
@@ -2,9 +2,13 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct lockstat;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct seqlock;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -44,8 +48,10 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlock_shared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -70,6 +76,14 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kref(char*);
+int             krefcount(char*);
+void            kallocdump(void);
+char*           kalloc_zeroed(void);
+char*           kalloc_order(int);
+void            kfree_order(char*, int);
+void            ksplit(char*, int);
+void            kzeroidle(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -81,6 +95,7 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(uchar, int);
 void            microdelay(int);
 
 // log.c
@@ -89,6 +104,19 @@ void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+uint            mmap(struct file*, uint, uint, int, int);
+int             munmap(uint, uint);
+int             msync(uint, uint);
+void            munmapall(struct proc*);
+int             mmapcopy(struct proc*, struct proc*);
+int             mmapfault(struct proc*, uint, int);
+int             mmapped(struct proc*, uint, uint);
+int             mmapoverlap(struct proc*, uint, uint);
+void            mmapimage(struct proc*, struct file*, uint, uint, uint, int);
+uint            shmat(int);
+int             shmdt(uint);
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
@@ -97,7 +125,14 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pagecache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+void            pcache_write(struct inode*, uint, char*, uint);
+void            pcache_drop(struct inode*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -109,6 +144,8 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+void            acquirevm(struct proc*);
+void            releasevm(struct proc*);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -121,6 +158,11 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+int             sleepq(void*, struct spinlock*, uint, uint);
+int             wakeupq(void*, pde_t*, int);
+int             wakeupq1(void*, pde_t*, int);
+void*           waitchan(void*);
+void            tickwakeup(void);
 void            yield(void);
 int             allotment[2];
 int             quantum[3];
@@ -132,6 +174,23 @@ void            thread_exit(void*);
 int             thread_join(thread_t, void**);
 void            cleanup_lwp(struct proc*, struct proc*);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint);
+int             shmrm(int);
+struct shm*     shmattach(int);
+void            shmdup(struct shm*);
+void            shmdetach(struct shm*);
+uint            shmsize(struct shm*);
+char*           shmpage(struct shm*, uint);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void(*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabdump(void);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -140,6 +199,12 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+int             lockbench(int, int);
+extern int      lockstat_on;
+struct lockstat* lockstat_register(char*, int);
+void            lockstat_acquired(struct lockstat*, int, unsigned long long, uint);
+void            lockstat_released(struct lockstat*, unsigned long long);
+int             lockstat_snapshot(struct lockstat*, int, int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -147,6 +212,8 @@ void            popcli(void);
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
+void            releasesleep_shared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -162,9 +229,11 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argptr_read(int, char**, int);
+int             argsync(int, char**, int);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchstr(uint, char*, int);
 void            syscall(void);
 
 // timer.c
@@ -175,6 +244,7 @@ void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
+extern struct seqlock tickseq;
 
 // uart.c
 void            uartinit(void);
@@ -183,6 +253,9 @@ void            uartputc(int);
 
 // vm.c
 void            seginit(void);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
+int             superpages(int);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
@@ -196,6 +269,14 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             mapshared(pde_t*, uint, char*);
+int             uvmmapped(pde_t*, uint, uint);
+int             cowpage(pde_t*, uint);
+int             uvmtouch(uint, uint, int);
+int             uvmsync(uint, uint, char**);
+int             uvmcopypage(pde_t*, uint, pte_t*);
+int             pagefault(uint, uint);
+void            tlbshootdown(pde_t*);
 
 // prac_syscall.c
 int		        my_syscall(char*);
@@ -205,19 +286,35 @@ int             TestAndSet(int*, int);
 void            Cond_init(thread_cond_t*);
 void            Cond_wait(thread_cond_t*, thread_mutex_t*);
 void            Cond_signal(thread_cond_t*);
+void            Cond_broadcast(thread_cond_t*);
+int             Cond_timedwait(thread_cond_t*, thread_mutex_t*, int);
 void            Mutex_init(thread_mutex_t*);
 void            Mutex_lock(thread_mutex_t*);
 void            Mutex_unlock(thread_mutex_t*);
-int             xem_init(xem_t*);
+int             xem_init(xem_t*, int);
 int             xem_wait(xem_t*);
+int             xem_trywait(xem_t*);
+int             xem_timedwait(xem_t*, int);
+int             xem_post_n(xem_t*, int);
 int             xem_unlock(xem_t*);
 
+// barrier.c
+int             barrier_init(barrier_t*, int);
+int             barrier_wait(barrier_t*);
+
 // rwlock.c
 int             rwlock_init(rwlock_t *rwlock);
+int             rwlock_init_mode(rwlock_t *rwlock, int mode);
 int             rwlock_acquire_readlock(rwlock_t *rwlock);
 int             rwlock_acquire_writelock(rwlock_t *rwlock);
 int             rwlock_release_readlock(rwlock_t *rwlock);
 int             rwlock_release_writelock(rwlock_t *rwlock);
 
+// syncobj.c
+void            syncobjinit(void);
+xem_t*          xem_open(char*, int);
+rwlock_t*       rwlock_open(char*, int);
+int             sync_unlink(char*);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
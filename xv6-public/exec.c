@@ -6,16 +6,65 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "tls.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+// The part of a program segment that is paged in from the file.
+struct seg {
+  uint va;
+  uint off;
+  uint len;
+  int prot;
+};
+
+// Set up segment ph to be paged in from ip when first touched: put
+// the pages that come whole from the file in *sg, for a mapping of
+// the file. The page where the file data ends and the bss begins is
+// read in now, since its bss part must be zero; the bss pages after
+// it are untouched heap.
+static int
+lazyseg(pde_t *pgdir, struct inode *ip, struct proghdr *ph, struct seg *sg)
+{
+  uint end, va, from;
+  char *mem;
+
+  end = ph->vaddr + ph->filesz;
+  sg->va = PGROUNDDOWN(ph->vaddr);
+  sg->off = ph->off - (ph->vaddr - sg->va);
+  sg->len = (ph->memsz > ph->filesz ? PGROUNDDOWN(end) : PGROUNDUP(end)) - sg->va;
+  sg->prot = PROT_READ;
+  if(ph->flags & ELF_PROG_FLAG_WRITE)
+    sg->prot |= PROT_WRITE;
+  if(ph->memsz == ph->filesz || end % PGSIZE == 0)
+    return 0;
+
+  va = PGROUNDDOWN(end);
+  from = va > ph->vaddr ? va : ph->vaddr;
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(readi(ip, mem + (from - va), ph->off + (from - ph->vaddr), end - from) != end - from ||
+     mappages(pgdir, (char*)va, PGSIZE, V2P(mem), (sg->prot & PROT_WRITE) ? PTE_W|PTE_U : PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
 
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
+  int i, off, nseg;
+  uint argc, sz, sp, ustack[3+MAXARG+1], tls;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct seg seg[NMMAP];
+  struct file *f;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -28,6 +77,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  f = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +88,12 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Load program into memory. A process pages in the segments laid
+  // out page by page in the file as it touches them, and shares them
+  // with every other process running the program until it writes
+  // them. Other segments, and those of an LWP, are read in now.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -47,8 +101,17 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > USERTOP)
       goto bad;
+    if(curproc->tid == 0 && nseg < NMMAP && ph.off % PGSIZE == ph.vaddr % PGSIZE &&
+       PGROUNDDOWN(ph.vaddr) >= PGROUNDUP(sz)){
+      if(lazyseg(pgdir, ip, &ph, &seg[nseg]) < 0)
+        goto bad;
+      if(seg[nseg].len > 0)
+        nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
@@ -56,6 +119,13 @@ exec(char *path, char **argv)
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
+  if(nseg > 0){
+    if((f = filealloc()) == 0)
+      goto bad;
+    f->type = FD_INODE;
+    f->ip = idup(ip);
+    f->readable = 1;
+  }
   iunlockput(ip);
   end_op();
   ip = 0;
@@ -68,6 +138,14 @@ exec(char *path, char **argv)
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
 
+  // Put the thread storage block at the top of the stack.
+  sp -= TLSSIZE;
+  tls = sp;
+  ustack[0] = tls;                // self
+  ustack[1] = curproc->tid;       // tid
+  if(copyout(pgdir, tls, ustack, 2*4) < 0)
+    goto bad;
+
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
@@ -101,12 +179,25 @@ exec(char *path, char **argv)
   else
       goto bad;
 
+  // The old image's file mappings go with it.
+  if(tid == 0)
+      munmapall(curproc);
+  if(f){
+    acquirevm(curproc);
+    for(i = 0; i < nseg; i++)
+      mmapimage(curproc, f, seg[i].va, seg[i].off, seg[i].len, seg[i].prot);
+    releasevm(curproc);
+    fileclose(f);
+  }
+
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
+  curproc->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+  curproc->tls = tls;
   switchuvm(curproc);
   // If curproc is a process, free oldpgdir.
   // If curproc is a LWP, do not free since it shares oldpgdir with its manager process.
@@ -122,5 +213,7 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(f)
+    fileclose(f);
   return -1;
 }
@@ -14,6 +14,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // Hash chain
+  struct inode *lnext, *lprev; // Unused inodes, least recently used first
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -154,29 +154,42 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// In-memory inodes come from a slab cache and are found through a
+// hash on (dev, inum). An inode whose ref drops to zero stays cached
+// on the unused list, and is freed when more than NINODE are unused,
+// so the number of active inodes is limited only by memory.
+//
+// The icache.lock spin-lock protects the hash and the unused list.
+// Since ip->ref indicates whether an entry is in use, and ip->dev
+// and ip->inum indicate which i-node an entry holds, one must hold
+// icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 64
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];
+  struct inode *unused;         // Circular list, oldest first
+  int nunused;
 } icache;
 
+static void
+inodector(void *ip)
+{
+  initsleeplock(&((struct inode*)ip)->lock, "inode");
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode), inodector);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -235,37 +248,84 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Put ip at the tail of the unused list. icache.lock must be held.
+static void
+unused_add(struct inode *ip)
+{
+  if(icache.unused == 0){
+    ip->lnext = ip->lprev = ip;
+    icache.unused = ip;
+  } else {
+    ip->lnext = icache.unused;
+    ip->lprev = icache.unused->lprev;
+    ip->lprev->lnext = ip;
+    icache.unused->lprev = ip;
+  }
+  icache.nunused++;
+}
+
+static void
+unused_remove(struct inode *ip)
+{
+  if(ip->lnext == ip)
+    icache.unused = 0;
+  else {
+    ip->lprev->lnext = ip->lnext;
+    ip->lnext->lprev = ip->lprev;
+    if(icache.unused == ip)
+      icache.unused = ip->lnext;
+  }
+  icache.nunused--;
+}
+
+// Take the least recently used unused inode out of the cache.
+// icache.lock must be held.
+static struct inode*
+ievict(void)
+{
+  struct inode *ip, **pp;
+
+  if((ip = icache.unused) == 0)
+    return 0;
+  unused_remove(ip);
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  return ip;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  uint h;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  h = IHASH(dev, inum);
+  for(ip = icache.hash[h]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        unused_remove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Allocate a new entry, or recycle an unused one if memory is short.
+  if((ip = kmem_cache_alloc(icache.cache)) == 0 && (ip = ievict()) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = icache.hash[h];
+  icache.hash[h] = ip;
   release(&icache.lock);
 
   return ip;
@@ -311,6 +371,31 @@ ilock(struct inode *ip)
   }
 }
 
+// Lock the given inode in shared mode, for readers that
+// change nothing in it. Reads the inode from disk if necessary.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  // Loading the inode needs the exclusive lock.
+  if(ip->valid == 0){
+    ilock(ip);
+    iunlock(ip);
+  }
+  acquiresleep_shared(&ip->lock);
+}
+
+void
+iunlock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlock_shared");
+
+  releasesleep_shared(&ip->lock);
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -322,8 +407,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry goes
+// on the unused list, to be freed or recycled later.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -347,7 +432,11 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    unused_add(ip);
+    if(icache.nunused > NINODE)
+      kmem_cache_free(icache.cache, ievict());
+  }
   release(&icache.lock);
 }
 
@@ -539,6 +628,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcache_drop(ip);
 }
 
 // Copy stat information from inode.
@@ -602,6 +692,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  pcache_write(ip, off, src, n);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -1,6 +1,11 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and blocks of
+// 2^order contiguous pages with kalloc_order().
+//
+// Free memory is kept by a buddy allocator: a free block of order k
+// is aligned to 2^k pages, and when both halves of an order k+1 block
+// are free they are merged back into it.
 
 #include "types.h"
 #include "defs.h"
@@ -8,21 +13,63 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "x86.h"
+#include "proc.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define MAXORDER 10                 // Largest block: 2^MAXORDER pages (4MB)
+#define NPAGE    (PHYSTOP/PGSIZE)
+
 struct run {
   struct run *next;
+  struct run *prev;   // Only used on the buddy lists
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1];  // Circular lists of free blocks per order
+  int nfree[MAXORDER+1];
+  uint failed[MAXORDER+1];      // Allocations that found no block
+  struct run *zeroed;           // Free pages zeroed ahead of time
+  int nzeroed;
+  ushort ref[NPAGE];            // Page tables mapping each page, for copy-on-write
+  uchar order[NPAGE];           // 1 + order of the free block starting here, or 0
 } kmem;
 
+#define PFN(v)   (V2P(v)/PGSIZE)
+#define PAGE(n)  ((char*)P2V((n)*PGSIZE))
+#define PGREF(v) (kmem.ref[PFN(v)])
+
+// Each CPU keeps a magazine of free pages, used with interrupts off
+// and without kmem.lock. An empty magazine is refilled, and a full one
+// drained, KBATCH pages at a time from the buddy lists.
+#define KMAG    32
+#define KBATCH  (KMAG/2)
+#define KBORDER 4       // 2^KBORDER == KBATCH
+
+// Idle CPUs zero free pages for kalloc_zeroed() until NZEROED are
+// ready, ZEROBATCH pages per call of kzeroidle().
+#define NZEROED   256
+#define ZEROBATCH 4
+
+// Build with -DKALLOC_DEBUG to fill freed pages with junk, which
+// catches dangling references, and to check pre-zeroed pages.
+
+struct kcache {
+  struct run *freelist;
+  int n;
+  uint hits;      // kalloc() served from the magazine
+  uint misses;    // kalloc() found the magazine empty
+  uint refills;   // Batches taken from the shared list
+  uint drains;    // Batches given back to it
+} __attribute__((aligned(64)));
+
+static struct kcache kcache[NCPU];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,8 +78,12 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int k;
+
   initlock(&kmem.lock, "kmem");
   kmem.use_lock = 0;
+  for(k = 0; k <= MAXORDER; k++)
+    kmem.free[k].next = kmem.free[k].prev = &kmem.free[k];
   freerange(vstart, vend);
 }
 
@@ -48,32 +99,173 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    PGREF(p) = 1;
     kfree(p);
+  }
+}
+
+static void
+buddy_push(char *v, int k)
+{
+  struct run *r = (struct run*)v, *h = &kmem.free[k];
+
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  kmem.order[PFN(v)] = k + 1;
+  kmem.nfree[k]++;
+}
+
+static void
+buddy_unlink(char *v, int k)
+{
+  struct run *r = (struct run*)v;
+
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.order[PFN(v)] = 0;
+  kmem.nfree[k]--;
+}
+
+// Take a block of 2^k pages, splitting a larger one if needed.
+// kmem.lock must be held.
+static char*
+buddy_alloc(int k)
+{
+  int j;
+  char *v;
+
+  for(j = k; j <= MAXORDER && kmem.nfree[j] == 0; j++)
+    ;
+  if(j > MAXORDER){
+    kmem.failed[k]++;
+    return 0;
+  }
+  v = (char*)kmem.free[j].next;
+  buddy_unlink(v, j);
+  // Give back the upper halves.
+  while(j > k){
+    j--;
+    buddy_push(v + (PGSIZE << j), j);
+  }
+  return v;
+}
+
+// Free a block of 2^k pages, merging it with its free buddies.
+// kmem.lock must be held.
+static void
+buddy_free(char *v, int k)
+{
+  uint pfn = PFN(v), bud;
+
+  for(; k < MAXORDER; k++){
+    bud = pfn ^ (1 << k);
+    if(bud >= NPAGE || kmem.order[bud] != k + 1)
+      break;
+    buddy_unlink(PAGE(bud), k);
+    pfn &= ~(1 << k);
+  }
+  buddy_push(PAGE(pfn), k);
 }
+
+// Move up to KBATCH pages from the buddy lists to magazine c,
+// as one block if possible. Called with interrupts off.
+static void
+krefill(struct kcache *c)
+{
+  struct run *r;
+  char *v;
+  int n;
+
+  acquire(&kmem.lock);
+  n = 0;
+  // Use up loose pages first; otherwise split off a whole batch.
+  if(kmem.nfree[0] < KBATCH){
+    if((v = buddy_alloc(KBORDER)) != 0){
+      for(; n < KBATCH; n++){
+        r = (struct run*)(v + n*PGSIZE);
+        r->next = c->freelist;
+        c->freelist = r;
+      }
+    }
+  }
+  for(; n < KBATCH && (v = buddy_alloc(0)) != 0; n++){
+    r = (struct run*)v;
+    r->next = c->freelist;
+    c->freelist = r;
+  }
+  // When memory is short, the zeroed pages are free pages too.
+  for(; n < KBATCH && (r = kmem.zeroed) != 0; n++){
+    kmem.zeroed = r->next;
+    kmem.nzeroed--;
+    r->next = c->freelist;
+    c->freelist = r;
+  }
+  release(&kmem.lock);
+  if(n > 0){
+    c->n += n;
+    c->refills++;
+  }
+}
+
+// Give KBATCH pages of magazine c back to the buddy lists.
+static void
+kdrain(struct kcache *c)
+{
+  struct run *r;
+  int n;
+
+  acquire(&kmem.lock);
+  for(n = 0; n < KBATCH; n++){
+    r = c->freelist;
+    c->freelist = r->next;
+    buddy_free((char*)r, 0);
+  }
+  release(&kmem.lock);
+  c->n -= KBATCH;
+  c->drains++;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page shared copy-on-write is only freed when its last
+// reference is dropped.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(PGREF(v) == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&PGREF(v), 1) > 0)
+    return;
 
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    // Still booting on one CPU.
+    buddy_free(v, 0);
+    return;
+  }
+  pushcli();
+  c = &kcache[cpuid()];
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->n > KMAG)
+    kdrain(c);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +275,176 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = (struct run*)buddy_alloc(0);
+  } else {
+    pushcli();
+    c = &kcache[cpuid()];
+    if(c->n > 0)
+      c->hits++;
+    else {
+      c->misses++;
+      // Out of memory here may still leave pages in other CPUs' magazines,
+      // but never more than KMAG each.
+      krefill(c);
+    }
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->n--;
+    }
+    popcli();
+  }
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    PGREF(r) = 1;
   return (char*)r;
 }
 
+// Allocate 2^order physically contiguous pages, aligned to their size.
+// Free them with kfree_order() and the same order.
+char*
+kalloc_order(int order)
+{
+  char *v;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  acquire(&kmem.lock);
+  v = buddy_alloc(order);
+  release(&kmem.lock);
+  if(v)
+    PGREF(v) = 1;
+  return v;
+}
+
+void
+kfree_order(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if((uint)v % (PGSIZE << order) || v < end || V2P(v) >= PHYSTOP ||
+     order > MAXORDER || PGREF(v) != 1)
+    panic("kfree_order");
+  PGREF(v) = 0;
+#ifdef KALLOC_DEBUG
+  memset(v, 1, PGSIZE << order);
+#endif
+  acquire(&kmem.lock);
+  buddy_free(v, order);
+  release(&kmem.lock);
+}
+
+// Let the pages of block v, allocated with kalloc_order(), be freed
+// one at a time with kfree() instead of all at once.
+void
+ksplit(char *v, int order)
+{
+  int i;
+
+  if(PGREF(v) != 1)
+    panic("ksplit");
+  for(i = 1; i < (1 << order); i++)
+    PGREF(v + i*PGSIZE) = 1;
+}
+
+// Allocate one zero-filled page. Takes a page zeroed by an
+// idle CPU if there is one.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r = 0;
+  char *v;
+
+  if(kmem.nzeroed > 0){
+    acquire(&kmem.lock);
+    if((r = kmem.zeroed) != 0){
+      kmem.zeroed = r->next;
+      kmem.nzeroed--;
+    }
+    release(&kmem.lock);
+  }
+  if(r == 0){
+    if((v = kalloc()) != 0)
+      memset(v, 0, PGSIZE);
+    return v;
+  }
+  v = (char*)r;
+  r->next = 0;    // The only word the free list used.
+#ifdef KALLOC_DEBUG
+  for(int i = 0; i < PGSIZE; i++)
+    if(v[i] != 0)
+      panic("kalloc_zeroed: written after free");
+#endif
+  PGREF(v) = 1;
+  return v;
+}
+
+// Zero a few free pages for kalloc_zeroed(), if the pool is not full.
+// Called by the scheduler when it finds nothing to run.
+void
+kzeroidle(void)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < ZEROBATCH && kmem.nzeroed < NZEROED; i++){
+    acquire(&kmem.lock);
+    r = (struct run*)buddy_alloc(0);
+    release(&kmem.lock);
+    if(r == 0)
+      return;
+    memset(r, 0, PGSIZE);
+    acquire(&kmem.lock);
+    r->next = kmem.zeroed;
+    kmem.zeroed = r;
+    kmem.nzeroed++;
+    release(&kmem.lock);
+  }
+}
+
+// Add a reference to page v, which is mapped by one more page table.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP || PGREF(v) == 0)
+    panic("kref");
+  __sync_fetch_and_add(&PGREF(v), 1);
+}
+
+// Number of references to page v.
+int
+krefcount(char *v)
+{
+  return PGREF(v);
+}
+
+// Print the free block counts and magazine counters on the console (^P).
+// Fragmentation is the share of free pages that are not in blocks
+// of the largest order.
+void
+kallocdump(void)
+{
+  struct kcache *c;
+  int k, nfree, nbig;
+
+  acquire(&kmem.lock);
+  nfree = 0;
+  for(k = 0; k <= MAXORDER; k++)
+    nfree += kmem.nfree[k] << k;
+  nbig = kmem.nfree[MAXORDER] << MAXORDER;
+  cprintf("kalloc: %d free pages, %d zeroed, fragmentation %d%%\n", nfree,
+          kmem.nzeroed, nfree ? 100 - nbig * 100 / nfree : 0);
+  cprintf("order\tfree\tfailed\n");
+  for(k = 0; k <= MAXORDER; k++)
+    cprintf("%d\t%d\t%d\n", k, kmem.nfree[k], kmem.failed[k]);
+  release(&kmem.lock);
+  for(c = kcache; c < kcache+ncpu; c++)
+    cprintf("cpu%d: %d cached, %d hits, %d misses, %d refills, %d drains\n",
+            (int)(c - kcache), c->n, c->hits, c->misses, c->refills, c->drains);
+}
+
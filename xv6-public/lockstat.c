@@ -0,0 +1,78 @@
+// Print kernel lock contention statistics.
+//
+//   lockstat on       start recording
+//   lockstat off      stop recording
+//   lockstat reset    zero the counters
+//   lockstat          print the locks, most contended first
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+struct lockstat st[NLOCKSTAT];
+
+// Cycle counts are printed in units of 1024 cycles.
+uint
+kcycles(unsigned long long c)
+{
+  return (uint)(c >> 10);
+}
+
+int
+hotter(struct lockstat *a, struct lockstat *b)
+{
+  if(a->contended != b->contended)
+    return a->contended > b->contended;
+  return a->acquires > b->acquires;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat t;
+  int i, j, n;
+
+  if(argc > 1){
+    if(strcmp(argv[1], "on") == 0)
+      n = lockstat(0, 0, LOCKSTAT_ENABLE);
+    else if(strcmp(argv[1], "off") == 0)
+      n = lockstat(0, 0, LOCKSTAT_DISABLE);
+    else if(strcmp(argv[1], "reset") == 0)
+      n = lockstat(0, 0, LOCKSTAT_RESET);
+    else {
+      printf(2, "usage: lockstat [on|off|reset]\n");
+      exit();
+    }
+    if(n < 0)
+      printf(2, "lockstat: failed\n");
+    exit();
+  }
+
+  if((n = lockstat(st, NLOCKSTAT, 0)) < 0){
+    printf(2, "lockstat: failed\n");
+    exit();
+  }
+  for(i = 1; i < n; i++){
+    t = st[i];
+    for(j = i; j > 0 && hotter(&t, &st[j-1]); j--)
+      st[j] = st[j-1];
+    st[j] = t;
+  }
+
+  printf(1, "name            kind   acquires  contended  wait(kcyc)  maxhold(kcyc)  call sites\n");
+  for(i = 0; i < n; i++){
+    if(st[i].acquires == 0)
+      continue;
+    printf(1, "%s", st[i].name);
+    for(j = strlen(st[i].name); j < 16; j++)
+      printf(1, " ");
+    printf(1, "%s  %d  %d  %d  %d ", st[i].kind == LOCKSTAT_SLEEP ? "sleep" : "spin ",
+           st[i].acquires, st[i].contended, kcycles(st[i].waitcycles), kcycles(st[i].maxhold));
+    for(j = 0; j < NLOCKPC; j++)
+      if(st[i].pccount[j])
+        printf(1, " %x(%d)", st[i].pc[j], st[i].pccount[j]);
+    printf(1, "\n");
+  }
+  exit();
+}
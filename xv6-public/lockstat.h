@@ -0,0 +1,24 @@
+// Lock contention statistics, kept per lock name
+// (all pipes share one entry, all buffers another).
+
+#define NLOCKSTAT 48   // Lock names tracked
+#define NLOCKPC 4      // Contending call sites kept per name
+
+#define LOCKSTAT_SPIN  0
+#define LOCKSTAT_SLEEP 1
+
+// Flags for the lockstat() system call.
+#define LOCKSTAT_RESET   1   // Zero the counters after taking the snapshot
+#define LOCKSTAT_ENABLE  2
+#define LOCKSTAT_DISABLE 4
+
+struct lockstat {
+  char name[16];
+  int kind;                       // LOCKSTAT_SPIN or LOCKSTAT_SLEEP
+  uint acquires;
+  uint contended;                 // Acquisitions that had to wait
+  unsigned long long waitcycles;  // rdtsc cycles spent waiting
+  unsigned long long maxhold;     // Longest hold in cycles
+  uint pc[NLOCKPC];               // Most frequent contending call sites
+  uint pccount[NLOCKPC];
+};
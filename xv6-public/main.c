@@ -29,7 +29,12 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  slabinit();      // object caches
   fileinit();      // file table
+  pipeinit();      // pipe cache
+  pcacheinit();    // page cache for mmap
+  shminit();       // shared memory segments
+  syncobjinit();   // named semaphores and rwlocks
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
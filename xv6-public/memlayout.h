@@ -7,6 +7,10 @@
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
+#define USERTOP  0x60000000         // Process size limit; shared mappings live above
+#define MMAPBASE USERTOP            // File mappings (mmap.c)
+#define MMAPTOP  SYNCPAGE
+#define SYNCPAGE (KERNBASE-PGSIZE)  // Named semaphores and rwlocks (syncobj.c)
 
 #define V2P(a) (((uint) (a)) - KERNBASE)
 #define P2V(a) ((void *)(((char *) (a)) + KERNBASE))
@@ -0,0 +1,7 @@
+// mmap() protection bits
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+// mmap() flags
+#define MAP_SHARED  0x1   // Writes go to the file, and to other mappings of it
+#define MAP_PRIVATE 0x2   // Writes make private copies
@@ -0,0 +1,445 @@
+// Mappings: mmap(), munmap() and msync() for files, shmat() and shmdt()
+// for shared memory segments.
+//
+// A mapping covers whole pages in [MMAPBASE, MMAPTOP) and is filled in
+// on page faults from the page cache (pagecache.c), so once a page is
+// cached, reading it through a mapping copies nothing. MAP_SHARED
+// mappings map the cached pages themselves: every mapping of the file
+// sees their writes at once, and the file, through the log, on msync()
+// or munmap(). MAP_PRIVATE mappings map them copy-on-write.
+//
+// Shared memory segments (shm.c) are attached as mappings without a
+// file, whose pages come from the segment instead.
+//
+// exec() maps the segments of a program this way too, below USERTOP,
+// so every process running it shares its text pages.
+//
+// The mappings are kept by the manager process and used by its LWPs,
+// and are changed with its address space lock held.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+#define VMABATCH 32   // Pages written back or unmapped per TLB shootdown
+
+#define INUSE(v) ((v)->f != 0 || (v)->shm != 0)
+
+static struct proc*
+vmaowner(struct proc *p)
+{
+  return p->tid > 0 ? p->manager : p;
+}
+
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  p = vmaowner(p);
+  for(v = p->vma; v < &p->vma[NMMAP]; v++)
+    if(INUSE(v) && va >= v->start && va < v->start + v->len)
+      return v;
+  return 0;
+}
+
+// Return 1 if [va, va+size) lies in one mapping of p.
+int
+mmapped(struct proc *p, uint va, uint size)
+{
+  struct vma *v;
+
+  if(size == 0 || va + size < va || (v = findvma(p, va)) == 0)
+    return 0;
+  return va + size <= v->start + v->len;
+}
+
+// Return 1 if any mapping of p overlaps [va, va+size).
+int
+mmapoverlap(struct proc *p, uint va, uint size)
+{
+  struct vma *v;
+
+  p = vmaowner(p);
+  for(v = p->vma; v < &p->vma[NMMAP]; v++)
+    if(INUSE(v) && va < v->start + v->len && v->start < va + size)
+      return 1;
+  return 0;
+}
+
+// Map the page of a mapping at va, reading it into the page cache
+// if needed. The caller must hold the address space lock.
+int
+mmapfault(struct proc *p, uint va, int write)
+{
+  struct vma *v;
+  struct inode *ip;
+  char *mem;
+  int perm;
+
+  if((v = findvma(p, va)) == 0 || (write && (v->prot & PROT_WRITE) == 0))
+    return -1;
+  va = PGROUNDDOWN(va);
+  if(v->shm)
+    mem = shmpage(v->shm, (va - v->start) / PGSIZE);
+  else {
+    ip = v->f->ip;
+    ilock(ip);
+    mem = pcache_get(ip, v->off + (va - v->start));
+    iunlock(ip);
+  }
+  if(mem == 0)
+    return -1;
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= (v->flags & MAP_SHARED) ? PTE_W : PTE_COW;
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  if(write && (v->flags & MAP_PRIVATE))
+    return cowpage(p->pgdir, va);
+  return 0;
+}
+
+// Write page mem back to ip at off, without growing the file.
+static int
+writeback(struct inode *ip, char *mem, uint off)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  uint i, n, m;
+
+  ilock(ip);
+  n = ip->size > off ? ip->size - off : 0;
+  iunlock(ip);
+  if(n > PGSIZE)
+    n = PGSIZE;
+  for(i = 0; i < n; i += m){
+    m = n - i < max ? n - i : max;
+    begin_op();
+    ilock(ip);
+    if(writei(ip, mem + i, off + i, m) != m){
+      iunlock(ip);
+      end_op();
+      return -1;
+    }
+    iunlock(ip);
+    end_op();
+  }
+  return 0;
+}
+
+// Write back the dirty pages of v in [a, end), and unmap all its pages
+// there if unmap is set. The PTEs are changed a batch at a time, and
+// the pages only written and freed once no CPU has them in its TLB,
+// so no write to them can go unnoticed.
+// The caller must hold the address space lock.
+static int
+vmaflush(struct proc *p, struct vma *v, uint a, uint end, int unmap)
+{
+  char *mem[VMABATCH];
+  uint va[VMABATCH];
+  uchar dirty[VMABATCH];
+  int shared, i, n, r;
+  pte_t *pte;
+
+  shared = v->f && (v->flags & MAP_SHARED) && (v->prot & PROT_WRITE);
+  r = 0;
+  while(a < end){
+    for(n = 0; a < end && n < VMABATCH; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+      if((*pte & PTE_P) == 0)
+        continue;
+      dirty[n] = shared && (*pte & PTE_D);
+      if(!dirty[n] && !unmap)
+        continue;
+      mem[n] = P2V(PTE_ADDR(*pte));
+      va[n] = a;
+      *pte = unmap ? 0 : *pte & ~PTE_D;
+      n++;
+    }
+    if(n == 0)
+      continue;
+    tlbshootdown(p->pgdir);
+    for(i = 0; i < n; i++){
+      if(dirty[i] && writeback(v->f->ip, mem[i], v->off + (va[i] - v->start)) < 0)
+        r = -1;
+      if(unmap)
+        kfree(mem[i]);
+    }
+  }
+  return r;
+}
+
+// Remove mapping v, writing its dirty pages back.
+// The caller must hold the address space lock.
+static int
+vmaremove(struct proc *p, struct vma *v)
+{
+  struct file *f;
+  int r;
+
+  r = vmaflush(p, v, v->start, v->start + v->len, 1);
+  if(v->shm){
+    shmdetach(v->shm);
+    v->shm = 0;
+  } else {
+    f = v->f;
+    v->f = 0;
+    fileclose(f);
+  }
+  return r;
+}
+
+// Find a free slot and a free range of len bytes for a new mapping
+// of p, and set its start and len. Returns 0 if there is none.
+// The caller must hold the address space lock.
+static struct vma*
+vmaalloc(struct proc *p, uint len)
+{
+  struct vma *v, *free;
+  uint va;
+  int moved;
+
+  free = 0;
+  for(v = p->vma; v < &p->vma[NMMAP]; v++)
+    if(!INUSE(v) && free == 0)
+      free = v;
+  if(free == 0 || len == 0 || len > MMAPTOP - MMAPBASE)
+    return 0;
+  // First fit: move past every mapping in the way until none is.
+  va = MMAPBASE;
+  do {
+    moved = 0;
+    for(v = p->vma; v < &p->vma[NMMAP]; v++){
+      if(INUSE(v) && va < v->start + v->len && v->start < va + len){
+        va = v->start + v->len;
+        moved = 1;
+      }
+    }
+  } while(moved);
+  if(va > MMAPTOP - len)
+    return 0;
+  free->start = va;
+  free->len = len;
+  return free;
+}
+
+// Map len bytes of f from offset off, which must be page-aligned,
+// into the current process. Returns the address, or 0.
+uint
+mmap(struct file *f, uint off, uint len, int prot, int flags)
+{
+  struct proc *p = vmaowner(myproc());
+  struct vma *v;
+  uint va = 0;
+
+  if(len == 0 || off % PGSIZE != 0 || f->type != FD_INODE || f->ip->type != T_FILE)
+    return 0;
+  if((prot & PROT_READ) == 0 || !f->readable)
+    return 0;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return 0;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return 0;
+
+  acquirevm(p);
+  if((v = vmaalloc(p, PGROUNDUP(len))) != 0){
+    v->off = off;
+    v->prot = prot;
+    v->flags = flags;
+    v->f = filedup(f);
+    va = v->start;
+  }
+  releasevm(p);
+  return va;
+}
+
+// Remove the mapping at addr, which must be len bytes long.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *p = vmaowner(myproc());
+  struct vma *v;
+  int r = -1;
+
+  acquirevm(p);
+  if(addr >= MMAPBASE && (v = findvma(p, addr)) != 0 && v->f &&
+     v->start == addr && v->len == PGROUNDUP(len))
+    r = vmaremove(p, v);
+  releasevm(p);
+  return r;
+}
+
+// Map len bytes of f from offset off privately at va, for exec().
+// va, off and len must be page-aligned, and p must have a free slot.
+void
+mmapimage(struct proc *p, struct file *f, uint va, uint off, uint len, int prot)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NMMAP]; v++)
+    if(!INUSE(v))
+      break;
+  if(v == &p->vma[NMMAP])
+    panic("mmapimage");
+  v->start = va;
+  v->len = len;
+  v->off = off;
+  v->prot = prot;
+  v->flags = MAP_PRIVATE;
+  v->f = filedup(f);
+}
+
+// Attach the shared memory segment id to the current process.
+// Returns the address, or 0.
+uint
+shmat(int id)
+{
+  struct proc *p = vmaowner(myproc());
+  struct shm *s;
+  struct vma *v;
+  uint va = 0;
+
+  if((s = shmattach(id)) == 0)
+    return 0;
+  acquirevm(p);
+  if((v = vmaalloc(p, shmsize(s))) != 0){
+    v->off = 0;
+    v->prot = PROT_READ | PROT_WRITE;
+    v->flags = MAP_SHARED;
+    v->shm = s;
+    va = v->start;
+  }
+  releasevm(p);
+  if(va == 0)
+    shmdetach(s);
+  return va;
+}
+
+// Detach the segment attached at addr.
+int
+shmdt(uint addr)
+{
+  struct proc *p = vmaowner(myproc());
+  struct vma *v;
+  int r = -1;
+
+  acquirevm(p);
+  if((v = findvma(p, addr)) != 0 && v->shm && v->start == addr)
+    r = vmaremove(p, v);
+  releasevm(p);
+  return r;
+}
+
+// Write the changes made to [addr, addr+len) of a shared mapping back
+// to the file.
+int
+msync(uint addr, uint len)
+{
+  struct proc *p = vmaowner(myproc());
+  struct vma *v;
+  int r = -1;
+
+  acquirevm(p);
+  if(mmapped(p, addr, len)){
+    v = findvma(p, addr);
+    r = vmaflush(p, v, PGROUNDDOWN(addr), PGROUNDUP(addr + len), 0);
+  }
+  releasevm(p);
+  return r;
+}
+
+// Remove all of p's mappings, on exit and exec.
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  acquirevm(p);
+  for(v = p->vma; v < &p->vma[NMMAP]; v++)
+    if(INUSE(v))
+      vmaremove(p, v);
+  releasevm(p);
+}
+
+// Give the new process np the mappings of p. Pages of shared mappings
+// and segments are mapped in both, and pages of private ones copy-on-write,
+// except those holding synchronization objects, which are copied now.
+// The caller must hold p's address space lock.
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  uint a;
+  int cow = 0;
+
+  p = vmaowner(p);
+  for(nv = np->vma; nv < &np->vma[NMMAP]; nv++){
+    nv->f = 0;
+    nv->shm = 0;
+  }
+  for(v = p->vma, nv = np->vma; v < &p->vma[NMMAP]; v++, nv++){
+    if(!INUSE(v))
+      continue;
+    *nv = *v;
+    if(nv->shm)
+      shmdup(nv->shm);
+    else
+      filedup(nv->f);
+    // copyuvm() has done the pages of the program image.
+    if(v->start < USERTOP)
+      continue;
+    for(a = v->start; a < v->start + v->len; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+      if((*pte & PTE_P) == 0)
+        continue;
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_SYNC)){
+        if(uvmcopypage(np->pgdir, a, pte) < 0)
+          goto bad;
+        continue;
+      }
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_W)){
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+        cow = 1;
+      }
+      // The parent writes back what it has dirtied.
+      if(mappages(np->pgdir, (char*)a, PGSIZE, PTE_ADDR(*pte), PTE_FLAGS(*pte) & ~PTE_D) < 0)
+        goto bad;
+      kref(P2V(PTE_ADDR(*pte)));
+    }
+  }
+  if(cow)
+    tlbshootdown(p->pgdir);
+  return 0;
+
+bad:
+  if(cow)
+    tlbshootdown(p->pgdir);
+  for(nv = np->vma; nv < &np->vma[NMMAP]; nv++){
+    if(nv->shm){
+      shmdetach(nv->shm);
+      nv->shm = 0;
+    } else if(nv->f){
+      fileclose(nv->f);
+      nv->f = 0;
+    }
+  }
+  return -1;
+}
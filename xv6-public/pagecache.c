@@ -0,0 +1,220 @@
+// Page cache: whole pages of file data, for mmap().
+//
+// A cached page is found by (dev, inum, page number) and holds a
+// kalloc() reference of its own; every mapping of it holds another.
+// writei() keeps the cached pages of a file up to date and itrunc()
+// drops them, so a cached page never goes stale. Pages nobody maps
+// any more are freed, least recently used first, once more than
+// NPCACHE are cached.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCACHE 512
+#define NPHASH  128
+#define PHASH(dev, inum, pgno) ((((dev)*31 + (inum))*131 + (pgno)) % NPHASH)
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint pgno;                    // Offset in the file / PGSIZE
+  char *page;
+  struct cpage *next;           // Hash chain
+  struct cpage *lnext, *lprev;  // Least recently used first
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct cpage *hash[NPHASH];
+  struct cpage *lru;            // Circular list, oldest first
+  int n;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("cpage", sizeof(struct cpage), 0);
+}
+
+static void
+lru_add(struct cpage *cp)
+{
+  if(pcache.lru == 0){
+    cp->lnext = cp->lprev = cp;
+    pcache.lru = cp;
+  } else {
+    cp->lnext = pcache.lru;
+    cp->lprev = pcache.lru->lprev;
+    cp->lprev->lnext = cp;
+    pcache.lru->lprev = cp;
+  }
+}
+
+static void
+lru_remove(struct cpage *cp)
+{
+  if(cp->lnext == cp)
+    pcache.lru = 0;
+  else {
+    cp->lprev->lnext = cp->lnext;
+    cp->lnext->lprev = cp->lprev;
+    if(pcache.lru == cp)
+      pcache.lru = cp->lnext;
+  }
+}
+
+// pcache.lock must be held.
+static struct cpage*
+lookup(uint dev, uint inum, uint pgno)
+{
+  struct cpage *cp;
+
+  for(cp = pcache.hash[PHASH(dev, inum, pgno)]; cp; cp = cp->next)
+    if(cp->dev == dev && cp->inum == inum && cp->pgno == pgno)
+      return cp;
+  return 0;
+}
+
+// Take cp out of the cache and drop the cache's reference to its page.
+// pcache.lock must be held.
+static void
+evict(struct cpage *cp)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.hash[PHASH(cp->dev, cp->inum, cp->pgno)]; *pp != cp; pp = &(*pp)->next)
+    ;
+  *pp = cp->next;
+  lru_remove(cp);
+  pcache.n--;
+  kfree(cp->page);
+  kmem_cache_free(pcache.cache, cp);
+}
+
+// Free unmapped pages, oldest first, until at most n are cached.
+// pcache.lock must be held.
+static void
+shrink(int n)
+{
+  struct cpage *cp, *next;
+  int i, len;
+
+  cp = pcache.lru;
+  len = pcache.n;
+  for(i = 0; i < len && pcache.n > n; i++, cp = next){
+    next = cp->lnext;
+    if(krefcount(cp->page) == 1)
+      evict(cp);
+  }
+}
+
+// Return the page of ip at file offset off, which must be page-aligned,
+// reading it in if it is not cached. The caller gets a reference to
+// the page and must kfree() it. Bytes past the end of the file are
+// zero. Returns 0 if memory ran out. Caller must hold ip->lock.
+char*
+pcache_get(struct inode *ip, uint off)
+{
+  struct cpage *cp;
+  char *mem;
+
+  acquire(&pcache.lock);
+  if((cp = lookup(ip->dev, ip->inum, off/PGSIZE)) != 0){
+    lru_remove(cp);
+    lru_add(cp);
+    kref(cp->page);
+    release(&pcache.lock);
+    return cp->page;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc_zeroed()) == 0){
+    acquire(&pcache.lock);
+    shrink(0);
+    release(&pcache.lock);
+    if((mem = kalloc_zeroed()) == 0)
+      return 0;
+  }
+  if((off < ip->size && readi(ip, mem, off, PGSIZE) < 0) ||
+     (cp = kmem_cache_alloc(pcache.cache)) == 0){
+    kfree(mem);
+    return 0;
+  }
+  cp->dev = ip->dev;
+  cp->inum = ip->inum;
+  cp->pgno = off/PGSIZE;
+  cp->page = mem;
+  kref(mem);
+
+  // Nobody else can have read the page in: that takes ip->lock.
+  acquire(&pcache.lock);
+  cp->next = pcache.hash[PHASH(cp->dev, cp->inum, cp->pgno)];
+  pcache.hash[PHASH(cp->dev, cp->inum, cp->pgno)] = cp;
+  lru_add(cp);
+  if(++pcache.n > NPCACHE)
+    shrink(NPCACHE);
+  release(&pcache.lock);
+  return mem;
+}
+
+// writei() is about to write n bytes from src to ip at off:
+// copy them into the cached pages too. Caller must hold ip->lock.
+// src may be user memory, which can fault, so each page is copied
+// with a reference to it held rather than with pcache.lock held.
+void
+pcache_write(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *cp;
+  char *page;
+  uint m;
+
+  if(pcache.n == 0)
+    return;
+  for(; n > 0; n -= m, off += m, src += m){
+    m = PGSIZE - off%PGSIZE;
+    if(m > n)
+      m = n;
+    page = 0;
+    acquire(&pcache.lock);
+    if((cp = lookup(ip->dev, ip->inum, off/PGSIZE)) != 0){
+      page = cp->page;
+      kref(page);
+    }
+    release(&pcache.lock);
+    if(page == 0)
+      continue;
+    // msync() writes a shared page from the page itself.
+    if(page + off%PGSIZE != src)
+      memmove(page + off%PGSIZE, src, m);
+    kfree(page);
+  }
+}
+
+// Drop the cached pages of ip, whose contents are being freed.
+// Pages still mapped live on in the mappings.
+void
+pcache_drop(struct inode *ip)
+{
+  struct cpage *cp, *next;
+  int i;
+
+  if(pcache.n == 0)
+    return;
+  acquire(&pcache.lock);
+  for(i = 0; i < NPHASH; i++){
+    for(cp = pcache.hash[i]; cp; cp = next){
+      next = cp->next;
+      if(cp->dev == ip->dev && cp->inum == ip->inum)
+        evict(cp);
+    }
+  }
+  release(&pcache.lock);
+}
@@ -6,6 +6,8 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "tls.h"
 
 int allotment[2] = {20, 40};     // Array to check if process has used up its allotment.
 int quantum[3] = {5, 10, 20};    // Array to check process's ticks with its time quantum.
@@ -70,6 +72,11 @@ struct {
   struct proc proc[NPROC];
 } ptable;
 
+// Lock on the size and user page table of each address space, indexed by
+// the ptable slot of its manager process. Growing or shrinking the memory
+// of one process does not hold ptable.lock, so it stalls nobody else.
+static struct sleeplock vmlock[NPROC];
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -81,7 +88,33 @@ static void wakeup1(void *chan);
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NPROC; i++)
+    initsleeplock(&vmlock[i], "vm");
+}
+
+static struct sleeplock*
+vmlockof(struct proc *p)
+{
+  if(p->tid > 0)
+    p = p->manager;
+  return &vmlock[p - ptable.proc];
+}
+
+// Lock the address space that p belongs to.
+// Must not be called with ptable.lock held.
+void
+acquirevm(struct proc *p)
+{
+  acquiresleep(vmlockof(p));
+}
+
+void
+releasevm(struct proc *p)
+{
+  releasesleep(vmlockof(p));
 }
 
 // Must be called with interrupts disabled
@@ -155,6 +188,7 @@ found:
   p->tid = 0;           // Initialize thread ID. (0 if manager process)
   p->nexttid = 1;       // Initialize nexttid(next tid to assign).
   p->stack_count = 0;   // Initialize number of elements in the stack to 0.
+  p->superpages = 1;    // Heap regions may use 4MB pages.
 
   release(&ptable.lock);
 
@@ -221,7 +255,10 @@ userinit(void)
 }
 
 // Grow current process's memory by n bytes.
+// Growing only reserves address space: pagefault() allocates
+// the pages when they are first touched.
 // Return 0 on success, -1 on failure.
+// Caller must hold the address space lock (acquirevm).
 int
 growproc(int n)
 {
@@ -229,36 +266,29 @@ growproc(int n)
   struct proc *curproc = myproc();
   struct proc *mgr;
 
-  acquire(&ptable.lock);    // Acquire lock to prevent race condition.
-
   // Set mgr as manager process.
   if(curproc->tid > 0)
       mgr = curproc->manager;
   else if(curproc->tid == 0)
       mgr = curproc;
-  else {
-      release(&ptable.lock);
+  else
       return -1;
-  }
 
   // Set sz as manager process's sz.
   sz = mgr->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0) {
-      release(&ptable.lock);
+    if(sz + n < sz || sz + n > USERTOP)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0) {
-      release(&ptable.lock);
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
-    }
+    // LWPs on other CPUs may still cache the freed pages.
+    tlbshootdown(curproc->pgdir);
   }
   // Update manager process's sz to the new sz.
   mgr->sz = sz;
 
-  release(&ptable.lock);
-
   switchuvm(curproc);
   return 0;
 }
@@ -282,20 +312,35 @@ fork(void)
   // Copy process state from proc.
   // When copying the page table,
   // size should be set to the manager process's memory size.
+  if(curproc->tid < 0)
+      goto bad;
+  acquirevm(curproc);
   if(curproc->tid > 0)
       sz = curproc->manager->sz;
-  else if(curproc->tid == 0)
-      sz = curproc->sz;
   else
-      goto bad;
-
-  if((np->pgdir = copyuvm(curproc->pgdir, sz)) == 0)
+      sz = curproc->sz;
+  np->pgdir = copyuvm(curproc->pgdir, sz);
+  if(np->pgdir != 0 && mmapcopy(curproc, np) < 0){
+      freevm(np->pgdir);
+      np->pgdir = 0;
+  }
+  releasevm(curproc);
+  if(np->pgdir == 0)
       goto bad;
 
   np->sz = sz;
   np->parent = curproc;
+  np->superpages = curproc->tid > 0 ? curproc->manager->superpages : curproc->superpages;
   *np->tf = *curproc->tf;
 
+  // The child is a manager process using the same thread storage block.
+  np->tls = curproc->tls;
+  if(np->tls != 0 && copyout(np->pgdir, np->tls + 4, &np->tid, 4) < 0) {
+      munmapall(np);
+      freevm(np->pgdir);
+      goto bad;
+  }
+
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
@@ -331,8 +376,8 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p, *mgr, *lwp;
-  int fd;
-  uint sz;
+  int fd, i, nstack;
+  uint sz, stack[NPROC];
 
   if(curproc == initproc)
     panic("init exiting");
@@ -357,6 +402,7 @@ exit(void)
   else
       return;
 
+  nstack = 0;
   acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
       // If p's manager is mgr and if p is not lwp, cleanup its resources.
@@ -389,18 +435,26 @@ exit(void)
           p->manager = 0;
           p->nexttid = 1;
           p->stack_count = 0;
-
-          // Clear page allocated to the LWP and push memory address to stack(for future use).
-          if((sz = deallocuvm(p->pgdir, p->sz, p->sz - 2*PGSIZE)) == 0) {
-              release(&ptable.lock);
-              return;
-          }
-          mgr->stack[(mgr->stack_count)++] = sz;
+          stack[nstack++] = p->sz;
           mgr->nexttid--;
       }
   }
   release(&ptable.lock);
 
+  // Clear pages allocated to the reaped LWPs and push their memory
+  // addresses to stack(for future use), without holding ptable.lock.
+  acquirevm(mgr);
+  for(i = 0; i < nstack; i++) {
+      if((sz = deallocuvm(mgr->pgdir, stack[i], stack[i] - 2*PGSIZE)) == 0)
+          break;
+      mgr->stack[(mgr->stack_count)++] = sz;
+  }
+  releasevm(mgr);
+
+  // Write back and drop the file mappings; the LWPs have been killed.
+  if(curproc->tid == 0)
+      munmapall(curproc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -504,10 +558,12 @@ scheduler(void)
     int found;                  // Check if there is a higher level process which is runnable.
     int sched_ticks = 0;        // Internal tick used for scheduler.
     int count = 0;              // Check count to ensure ratio of stride and MLFQ scheduling.
+    int ran;                    // Did this pass run anything?
 
     for(;;){
         // Enable interrupts on this processor.
         sti();
+        ran = 0;
 
         // Loop over process table looking for process to run.
         acquire(&ptable.lock);
@@ -574,6 +630,7 @@ execution:
             // Switch to chosen process.  It is the process's job
             // to release ptable.lock and then reacquire it
             // before jumping back to us.
+            ran = 1;
             c->proc = p;
             switchuvm(p);
             p->state = RUNNING;
@@ -586,6 +643,10 @@ execution:
             c->proc = 0;
         }
         release(&ptable.lock);
+
+        // Nothing to run: prepare zeroed pages for later.
+        if(!ran)
+            kzeroidle();
     }
 }
 
@@ -672,6 +733,7 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
   struct proc *np;
   struct proc *curproc = myproc();
   uint sp, sz, ustack[2];
+  struct tls tls;
 
   // Allocate light-weight process.
   if((np = allocproc()) == 0){
@@ -700,31 +762,56 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
   // Assign tid to the thread id.
   *thread = np->tid;
 
+  acquirevm(curproc);
+
   // If the manager process's stack is empty, there is no empty space in the memory.
   // Thus, increase the memory size of the manager process.
-  if(curproc->stack_count == 0) {
+  if(curproc->stack_count == 0)
       sz = curproc->sz;                     // Set starting memory address for the LWP as the size of the manager process.
-      curproc->sz += 2*PGSIZE;              // Increase manager process memory by 2*PGSIZE.
-  }
   else if(curproc->stack_count > 0)         // If it is not empty, there is empty space in the memory.
       sz = curproc->stack[--(curproc->stack_count)];   // Pop the memory address from the stack.
-  else
+  else {
+      releasevm(curproc);
       goto bad;
+  }
 
   // Allocate two pages to the LWP. The first one is the guard page, and the second is the user stack.
-  sz = PGROUNDUP(sz);
-  if((np->sz = allocuvm(np->pgdir, sz, sz + 2*PGSIZE)) == 0)
+  if((np->sz = allocuvm(np->pgdir, PGROUNDUP(sz), PGROUNDUP(sz) + 2*PGSIZE)) == 0) {
+      if(sz != curproc->sz)                 // Give a reused slot back.
+          curproc->stack[(curproc->stack_count)++] = sz;
+      releasevm(curproc);
       goto bad;
+  }
+  if(sz == curproc->sz)
+      curproc->sz = np->sz;                 // Increase manager process memory.
   // Creates inaccessible page beneath the user stack.
   clearpteu(np->pgdir, (char*)(np->sz - 2*PGSIZE));
   sp = np->sz;      // Set stack pointer.
+
+  // The page table is shared and copyout() may copy a copy-on-write
+  // page, so the address space lock stays held until both copies are done.
+  // Reserve the thread storage block at the top of the user stack.
+  sp -= TLSSIZE;
+  memset(&tls, 0, sizeof(tls));
+  tls.self = (struct tls*)sp;
+  tls.tid = np->tid;
+  if(copyout(np->pgdir, sp, &tls, sizeof(tls)) < 0) {
+      releasevm(curproc);
+      goto bad;
+  }
+  np->tls = sp;
+  np->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+
   sp -= 2*4;        // Decrease sp by 2 * 4(two bytes).
 
   ustack[0] = 0xffffffff;       // Fake return PC.
   ustack[1] = (uint)arg;        // Set arg to user stack.
   // Copy ustack(8 bytes) to the user address sp in the LWP's pgdir.
-  if(copyout(np->pgdir, sp, ustack, 2*4) < 0)
+  if(copyout(np->pgdir, sp, ustack, 2*4) < 0) {
+      releasevm(curproc);
       goto bad;
+  }
+  releasevm(curproc);
 
   // Set stack pointer and instruction pointer of the LWP.
   np->tf->esp = sp;                     // Points to the user stack of the LWP.
@@ -793,7 +880,7 @@ thread_join(thread_t thread, void **retval)
   struct proc *p;
   struct proc *curproc = myproc();
   int havelwp;
-  uint sz;
+  uint sz, stack;
 
   // Only manager process can call thread_join.
   if(curproc->tid != 0) {
@@ -832,16 +919,18 @@ thread_join(thread_t thread, void **retval)
         p->manager = 0;
         p->nexttid = 1;
         p->stack_count = 0;
+        stack = p->sz;
+        curproc->nexttid--;
+        release(&ptable.lock);
 
         // Clear page allocated to the LWP and push memory address to stack(for future use).
-        if((sz = deallocuvm(p->pgdir, p->sz, p->sz - 2*PGSIZE)) == 0) {
-            release(&ptable.lock);
+        acquirevm(curproc);
+        if((sz = deallocuvm(curproc->pgdir, stack, stack - 2*PGSIZE)) == 0) {
+            releasevm(curproc);
             return -1;
         }
         curproc->stack[(curproc->stack_count)++] = sz;
-        curproc->nexttid--;
-
-        release(&ptable.lock);
+        releasevm(curproc);
         return 0;
       }
     }
@@ -936,6 +1025,50 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
+// Sleep on chan holding position ticket in a FIFO wait queue.
+// Like sleep(), lk is released while asleep and reacquired on return.
+// If timeout is non-zero, the sleep also ends once ticks reaches timeout.
+// Returns 0 if the caller was chosen by wakeupq(), -1 if it woke up
+// for any other reason (timeout, kill, or a plain wakeup on chan).
+int
+sleepq(void *chan, struct spinlock *lk, uint ticket, uint timeout)
+{
+  struct proc *p = myproc();
+  int r;
+
+  if(ticket == 0)
+    panic("sleepq ticket");
+  if(chan == 0)
+    return -1;    // The object's page is gone (see waitchan()).
+
+  // wakeupq() only changes waitticket while p is SLEEPING,
+  // so it is stable once sleep() returns.
+  p->waitticket = ticket;
+  p->deadline = timeout;
+  sleep(chan, lk);
+  r = (p->waitticket == 0) ? 0 : -1;
+  p->waitticket = 0;
+  p->deadline = 0;
+  return r;
+}
+
+// Wait queue key for a synchronization object at addr: the kernel
+// address of the physical memory holding it. Processes that map the
+// object's page, at whatever address, sleep and wake on the same key.
+// System calls pass the kernel address from argsync() already.
+// Returns 0 if a user address is no longer mapped.
+void*
+waitchan(void *addr)
+{
+  char *ka;
+
+  if((uint)addr >= KERNBASE)
+    return addr;
+  if((ka = uva2ka(myproc()->pgdir, (char*)PGROUNDDOWN((uint)addr))) == 0)
+    return 0;
+  return ka + ((uint)addr & (PGSIZE - 1));
+}
+
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
@@ -958,6 +1091,67 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Wake up the n longest-waiting processes that sleep on chan in sleepq().
+// If pgdir is non-zero, only processes using that page table are considered.
+// Returns the number of processes woken up.
+// The ptable lock must be held.
+int
+wakeupq1(void *chan, pde_t *pgdir, int n)
+{
+  struct proc *p, *waiters[NPROC];
+  int j, min, nwaiters, woken;
+
+  // Collect the candidates in one pass over the process table.
+  nwaiters = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state == SLEEPING && p->chan == chan && p->waitticket != 0 &&
+       (pgdir == 0 || p->pgdir == pgdir))
+      waiters[nwaiters++] = p;
+
+  // Grant the oldest tickets first. Tickets may wrap, so compare differences.
+  for(woken = 0; woken < n && woken < nwaiters; woken++){
+    min = woken;
+    for(j = woken + 1; j < nwaiters; j++)
+      if((int)(waiters[j]->waitticket - waiters[min]->waitticket) < 0)
+        min = j;
+    p = waiters[min];
+    waiters[min] = waiters[woken];
+    waiters[woken] = p;
+    p->waitticket = 0;
+    p->state = RUNNABLE;
+  }
+  return woken;
+}
+
+// Wake up the n longest-waiting processes that sleep on chan in sleepq().
+int
+wakeupq(void *chan, pde_t *pgdir, int n)
+{
+  int woken;
+
+  acquire(&ptable.lock);
+  woken = wakeupq1(chan, pgdir, n);
+  release(&ptable.lock);
+  return woken;
+}
+
+// Called on every clock tick with tickslock held.
+// Wake up processes sleeping on ticks and timed sleepers whose deadline has passed.
+void
+tickwakeup(void)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state != SLEEPING)
+      continue;
+    if(p->chan == &ticks || (p->deadline != 0 && (int)(ticks - p->deadline) >= 0))
+      p->state = RUNNABLE;
+  }
+  release(&ptable.lock);
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
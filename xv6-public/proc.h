@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint tlbflushes;    // TLB shootdowns handled (see tlbshootdown)
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,6 +35,17 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A mapping made by mmap() or shmat(), somewhere in [MMAPBASE, MMAPTOP).
+struct vma {
+  uint start;                  // User address, page-aligned
+  uint len;                    // Multiple of PGSIZE
+  uint off;                    // File offset mapped at start
+  int prot;                    // PROT_ bits (mman.h)
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // The file mapped, or
+  struct shm *shm;             // the shared memory segment (shm.c); both null if free
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -61,6 +73,13 @@ struct proc {
   uint stack[NPROC];           // Stack to save freed memory space.
   int stack_count;             // Number of elements in the stack.
   void *retval;                // Return value of thread.
+  uint waitticket;             // Position in a FIFO wait queue (0 once granted by wakeupq).
+  uint deadline;               // Tick at which a timed sleep expires (0 if none).
+  uint tls;                    // User address of the thread storage block (%gs base).
+  struct vma vma[NMMAP];       // File mappings; LWPs use their manager's
+  int superpages;              // Back whole 4MB heap regions with superpages
+  char *pinned[2];             // Pages argsync() holds for the current system call
+  int npinned;                 // Number of pinned pages
 };
 
 // Process memory is laid out contiguously, low addresses first:
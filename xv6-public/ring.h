@@ -0,0 +1,307 @@
+// Bounded lock-free queues of pointers, for passing work between threads.
+//
+// struct spsc is a ring for exactly one producer and one consumer thread.
+// Each side owns one index and only reads the other's, so neither needs
+// a locked instruction.
+//
+// struct mpmc takes any number of producers and consumers. It is the
+// bounded queue of Dmitry Vyukov: every cell carries a sequence number
+// that says whether it is ready to be filled or to be emptied in the
+// current lap, so a thread claims a cell with a single cmpxchg on the
+// tail (put) or head (get) index.
+//
+// The caller supplies the slot array; its size must be a power of two.
+// The _try functions never block and return -1 if the queue is full or
+// empty. spsc_put/spsc_get and mpmc_put/mpmc_get spin for a while and
+// then sleep on a semaphore, so they only make system calls when the
+// queue stays full or empty. A sleeping thread is only woken by the
+// blocking functions: do not mix them with the _try ones on the
+// other side of a queue.
+//
+// Include after types.h, user.h and x86.h.
+
+#define RINGSPIN 200    // Failed tries before a blocking call sleeps
+
+struct ringwait {
+  volatile uint nsleeping;    // Threads asleep (or about to sleep) on sem
+  xem_t sem;
+};
+
+struct spsc {
+  volatile uint head;         // Next slot to read; written by the consumer
+  char pad0[60];
+  volatile uint tail;         // Next slot to write; written by the producer
+  char pad1[60];
+  uint mask;
+  void **slot;
+  struct ringwait notempty;   // The consumer waits here
+  struct ringwait notfull;    // The producer waits here
+};
+
+struct mpmc_cell {
+  volatile uint seq;
+  void *data;
+};
+
+struct mpmc {
+  volatile uint head;         // Next cell to read
+  char pad0[60];
+  volatile uint tail;         // Next cell to write
+  char pad1[60];
+  uint mask;
+  struct mpmc_cell *cell;
+  struct ringwait notempty;
+  struct ringwait notfull;
+};
+
+static inline void
+ringwait_init(struct ringwait *w)
+{
+  w->nsleeping = 0;
+  xem_init(&w->sem, 0);
+}
+
+// Wake one thread sleeping on w, if any. Called after changing the
+// queue; the fence keeps the sleeper's last check from missing the change.
+static inline void
+ring_wake(struct ringwait *w)
+{
+  uint n;
+
+  mfence();
+  while((n = w->nsleeping) > 0) {
+    if(cmpxchg(&w->nsleeping, n, n - 1) == n) {
+      xem_unlock(&w->sem);
+      return;
+    }
+  }
+}
+
+// Announce that we are about to sleep on w. The caller must try
+// the queue once more before calling ring_sleep().
+static inline void
+ring_prepare(struct ringwait *w)
+{
+  asm volatile("lock; incl %0" : "+m" (w->nsleeping) : : "memory", "cc");
+}
+
+// The last try succeeded after all: take back our announcement, unless a
+// waker has already consumed it. Then a spare post is left behind and
+// only costs a spurious wakeup later.
+static inline void
+ring_cancel(struct ringwait *w)
+{
+  uint n;
+
+  while((n = w->nsleeping) > 0)
+    if(cmpxchg(&w->nsleeping, n, n - 1) == n)
+      return;
+}
+
+static inline void
+ring_sleep(struct ringwait *w)
+{
+  xem_wait(&w->sem);
+}
+
+static inline int
+spsc_init(struct spsc *q, void **slot, uint size)
+{
+  if(size == 0 || (size & (size - 1)) != 0)
+    return -1;
+  q->head = q->tail = 0;
+  q->mask = size - 1;
+  q->slot = slot;
+  ringwait_init(&q->notempty);
+  ringwait_init(&q->notfull);
+  return 0;
+}
+
+static inline int
+spsc_tryput(struct spsc *q, void *v)
+{
+  uint t = q->tail;
+
+  if(t - q->head > q->mask)
+    return -1;
+  q->slot[t & q->mask] = v;
+  asm volatile("" : : : "memory");
+  q->tail = t + 1;
+  return 0;
+}
+
+static inline int
+spsc_tryget(struct spsc *q, void **v)
+{
+  uint h = q->head;
+
+  if(h == q->tail)
+    return -1;
+  asm volatile("" : : : "memory");
+  *v = q->slot[h & q->mask];
+  asm volatile("" : : : "memory");
+  q->head = h + 1;
+  return 0;
+}
+
+static inline void
+spsc_put(struct spsc *q, void *v)
+{
+  int i;
+
+  for(;;) {
+    for(i = 0; i < RINGSPIN; i++) {
+      if(spsc_tryput(q, v) == 0)
+        goto done;
+      pause();
+    }
+    ring_prepare(&q->notfull);
+    if(spsc_tryput(q, v) == 0) {
+      ring_cancel(&q->notfull);
+      goto done;
+    }
+    ring_sleep(&q->notfull);
+  }
+done:
+  ring_wake(&q->notempty);
+}
+
+static inline void*
+spsc_get(struct spsc *q)
+{
+  void *v;
+  int i;
+
+  for(;;) {
+    for(i = 0; i < RINGSPIN; i++) {
+      if(spsc_tryget(q, &v) == 0)
+        goto done;
+      pause();
+    }
+    ring_prepare(&q->notempty);
+    if(spsc_tryget(q, &v) == 0) {
+      ring_cancel(&q->notempty);
+      goto done;
+    }
+    ring_sleep(&q->notempty);
+  }
+done:
+  ring_wake(&q->notfull);
+  return v;
+}
+
+static inline int
+mpmc_init(struct mpmc *q, struct mpmc_cell *cell, uint size)
+{
+  uint i;
+
+  if(size == 0 || (size & (size - 1)) != 0)
+    return -1;
+  for(i = 0; i < size; i++)
+    cell[i].seq = i;
+  q->head = q->tail = 0;
+  q->mask = size - 1;
+  q->cell = cell;
+  ringwait_init(&q->notempty);
+  ringwait_init(&q->notfull);
+  return 0;
+}
+
+// A cell at position pos is free for a producer when its sequence
+// number is pos, and full for a consumer when it is pos + 1.
+static inline int
+mpmc_tryput(struct mpmc *q, void *v)
+{
+  struct mpmc_cell *c;
+  uint pos = q->tail;
+  int dif;
+
+  for(;;) {
+    c = &q->cell[pos & q->mask];
+    dif = (int)(c->seq - pos);
+    if(dif == 0) {
+      if(cmpxchg(&q->tail, pos, pos + 1) == pos)
+        break;
+      pos = q->tail;
+    } else if(dif < 0)
+      return -1;    // The cell still holds last lap's item: full.
+    else
+      pos = q->tail;
+  }
+  c->data = v;
+  asm volatile("" : : : "memory");
+  c->seq = pos + 1;
+  return 0;
+}
+
+static inline int
+mpmc_tryget(struct mpmc *q, void **v)
+{
+  struct mpmc_cell *c;
+  uint pos = q->head;
+  int dif;
+
+  for(;;) {
+    c = &q->cell[pos & q->mask];
+    dif = (int)(c->seq - (pos + 1));
+    if(dif == 0) {
+      if(cmpxchg(&q->head, pos, pos + 1) == pos)
+        break;
+      pos = q->head;
+    } else if(dif < 0)
+      return -1;    // Not yet filled in this lap: empty.
+    else
+      pos = q->head;
+  }
+  asm volatile("" : : : "memory");
+  *v = c->data;
+  asm volatile("" : : : "memory");
+  c->seq = pos + q->mask + 1;
+  return 0;
+}
+
+static inline void
+mpmc_put(struct mpmc *q, void *v)
+{
+  int i;
+
+  for(;;) {
+    for(i = 0; i < RINGSPIN; i++) {
+      if(mpmc_tryput(q, v) == 0)
+        goto done;
+      pause();
+    }
+    ring_prepare(&q->notfull);
+    if(mpmc_tryput(q, v) == 0) {
+      ring_cancel(&q->notfull);
+      goto done;
+    }
+    ring_sleep(&q->notfull);
+  }
+done:
+  ring_wake(&q->notempty);
+}
+
+static inline void*
+mpmc_get(struct mpmc *q)
+{
+  void *v;
+  int i;
+
+  for(;;) {
+    for(i = 0; i < RINGSPIN; i++) {
+      if(mpmc_tryget(q, &v) == 0)
+        goto done;
+      pause();
+    }
+    ring_prepare(&q->notempty);
+    if(mpmc_tryget(q, &v) == 0) {
+      ring_cancel(&q->notempty);
+      goto done;
+    }
+    ring_sleep(&q->notempty);
+  }
+done:
+  ring_wake(&q->notfull);
+  return v;
+}
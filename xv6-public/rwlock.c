@@ -7,46 +7,204 @@
 #include "proc.h"
 #include "spinlock.h"
 
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+// Bits of rwlock->state. The low bits count the readers holding the lock.
+#define RW_WRITER  0x80000000   // A writer holds the lock.
+#define RW_WAITERS 0x40000000   // Someone is queued: everybody takes the slow path.
+#define RW_READERS 0x0000ffff
+
+// Readers and writers sleep in separate FIFO queues, keyed by the
+// physical addresses of these fields, so that processes sharing the
+// lock's page share its queues. A key of 0 means the page is gone:
+// nobody sleeps on it, and wakeupq1() finds nobody to wake.
+#define RCHAN(rw) waitchan((void*)&(rw)->rwaiting)
+#define WCHAN(rw) waitchan((void*)&(rw)->wwaiting)
+
+int rwlock_init_mode(rwlock_t *rwlock, int mode)
+{
+    if(mode != RWLOCK_READER_PREF && mode != RWLOCK_WRITER_PREF && mode != RWLOCK_PHASE_FAIR)
+        return -1;
+    memset(rwlock, 0, sizeof(*rwlock));
+    rwlock->mode = mode;
+    return 0;
+}
+
 int rwlock_init(rwlock_t *rwlock)
 {
-    rwlock->readers = 0;
-    xem_init(&rwlock->lock);
-    xem_init(&rwlock->writelock);
+    return rwlock_init_mode(rwlock, RWLOCK_READER_PREF);
+}
+
+// Set RW_WAITERS so that no fast path can change the state any more.
+// Called with ptable.lock held; the state is then stable until the
+// flag is cleared again by rw_unfreeze().
+static void
+rw_freeze(rwlock_t *rw)
+{
+    uint s;
+
+    do {
+        s = rw->state;
+    } while(cmpxchg(&rw->state, s, s | RW_WAITERS) != s);
+}
+
+static void
+rw_unfreeze(rwlock_t *rw)
+{
+    if(rw->rwaiting == 0 && rw->wwaiting == 0)
+        rw->state &= ~RW_WAITERS;
+}
+
+// Hand the lock to queued waiters, if the policy lets them in now.
+// Granted waiters get the lock directly and need not retry.
+// writer is 1 if a writer has just released the lock.
+// The state must be frozen and ptable.lock held.
+static void
+rw_grant1(rwlock_t *rw, int writer)
+{
+    int n;
+
+    if(rw->state & RW_WRITER)
+        return;
+
+    // Readers go first under reader preference, when no writer waits, and,
+    // under the phase-fair policy, after every write phase.
+    if(rw->rwaiting > 0 &&
+       (rw->mode == RWLOCK_READER_PREF || rw->wwaiting == 0 ||
+        (rw->mode == RWLOCK_PHASE_FAIR && writer))) {
+        n = wakeupq1(RCHAN(rw), 0, rw->rwaiting);
+        rw->state += n;
+        rw->rwaiting -= n;
+    } else if((rw->state & RW_READERS) == 0 && rw->wwaiting > 0) {
+        if(wakeupq1(WCHAN(rw), 0, 1) == 1) {
+            rw->state |= RW_WRITER;
+            rw->wwaiting--;
+        }
+    }
+}
+
+// Queue up and sleep until rw_grant1() hands over the lock.
+// ptable.lock must be held and the state frozen.
+static int
+rw_sleep1(rwlock_t *rw, int writer)
+{
+    struct proc *p = myproc();
+    uint start = ticks, waited, ticket;
+    void *chan = writer ? WCHAN(rw) : RCHAN(rw);
+
+    if(chan == 0)
+        return -1;
+    if(writer) {
+        rw->wwaiting++;
+        ticket = ++rw->wticket ? rw->wticket : ++rw->wticket;
+    } else {
+        rw->rwaiting++;
+        ticket = ++rw->rticket ? rw->rticket : ++rw->rticket;
+    }
+
+    for(;;) {
+        if(sleepq(chan, &ptable.lock, ticket, 0) == 0)
+            break;
+        if(p->killed) {
+            // Leave the queue; whoever was behind us may be able to go now.
+            if(writer)
+                rw->wwaiting--;
+            else
+                rw->rwaiting--;
+            rw_grant1(rw, 0);
+            return -1;
+        }
+    }
+
+    waited = ticks - start;
+    if(writer) {
+        rw->wwaits++;
+        rw->wwaitticks += waited;
+        if(waited > rw->wmaxwait)
+            rw->wmaxwait = waited;
+    } else {
+        rw->rwaits++;
+        rw->rwaitticks += waited;
+        if(waited > rw->rmaxwait)
+            rw->rmaxwait = waited;
+    }
     return 0;
 }
 
 int rwlock_acquire_readlock(rwlock_t *rwlock)
 {
-    // Increment readers by 1.
-    xem_wait(&rwlock->lock);
-    rwlock->readers++;
-    // If the caller is the first reader, acquire the write lock as well.
-    if(rwlock->readers == 1)
-        xem_wait(&rwlock->writelock);
-    xem_unlock(&rwlock->lock);
-    return 0;
+    uint s;
+    int r = 0;
+
+    // Fast path: nobody writes and nobody waits.
+    s = rwlock->state;
+    if((s & (RW_WRITER | RW_WAITERS)) == 0 && cmpxchg(&rwlock->state, s, s + 1) == s)
+        return 0;
+
+    acquire(&ptable.lock);
+    rw_freeze(rwlock);
+    if((rwlock->state & RW_WRITER) == 0 &&
+       (rwlock->mode == RWLOCK_READER_PREF || rwlock->wwaiting == 0))
+        rwlock->state++;
+    else
+        r = rw_sleep1(rwlock, 0);
+    rw_unfreeze(rwlock);
+    release(&ptable.lock);
+    return r;
 }
 
 int rwlock_acquire_writelock(rwlock_t *rwlock)
 {
-    xem_wait(&rwlock->writelock);
-    return 0;
+    int r = 0;
+
+    if(cmpxchg(&rwlock->state, 0, RW_WRITER) == 0)
+        return 0;
+
+    acquire(&ptable.lock);
+    rw_freeze(rwlock);
+    if((rwlock->state & (RW_WRITER | RW_READERS)) == 0 && rwlock->rwaiting == 0)
+        rwlock->state |= RW_WRITER;
+    else
+        r = rw_sleep1(rwlock, 1);
+    rw_unfreeze(rwlock);
+    release(&ptable.lock);
+    return r;
 }
 
 int rwlock_release_readlock(rwlock_t *rwlock)
 {
-    // Decrement readers by 1.
-    xem_wait(&rwlock->lock);
-    rwlock->readers--;
-    // If the caller is the last reader, release the write lock.
-    if(rwlock->readers == 0)
-        xem_unlock(&rwlock->writelock);
-    xem_unlock(&rwlock->lock);
+    uint s;
+
+    s = rwlock->state;
+    if((s & RW_READERS) == 0 || (s & RW_WRITER))
+        return -1;
+    if((s & RW_WAITERS) == 0 && cmpxchg(&rwlock->state, s, s - 1) == s)
+        return 0;
+
+    acquire(&ptable.lock);
+    rw_freeze(rwlock);
+    rwlock->state--;
+    rw_grant1(rwlock, 0);
+    rw_unfreeze(rwlock);
+    release(&ptable.lock);
     return 0;
 }
 
 int rwlock_release_writelock(rwlock_t *rwlock)
 {
-    xem_unlock(&rwlock->writelock);
+    if((rwlock->state & RW_WRITER) == 0)
+        return -1;
+    if(cmpxchg(&rwlock->state, RW_WRITER, 0) == RW_WRITER)
+        return 0;
+
+    acquire(&ptable.lock);
+    rw_freeze(rwlock);
+    rwlock->state &= ~RW_WRITER;
+    rw_grant1(rwlock, 1);
+    rw_unfreeze(rwlock);
+    release(&ptable.lock);
     return 0;
 }
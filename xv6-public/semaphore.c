@@ -12,19 +12,28 @@ extern struct {
   struct proc proc[NPROC];
 } ptable;
 
+// Maximum number of times Mutex_lock() polls the lock word while the owner is running.
+#define MUTEX_SPIN 2000
+
+static void mutex_release1(thread_mutex_t *lock);
+
 int TestAndSet(int *ptr, int new) {
-    int old = *ptr;
-    *ptr = new;
-    return old;
+    return xchg((uint*)ptr, new);
 }
 
 void Cond_init(thread_cond_t *cond) {
     cond->waiting_threads = 0;
-    Mutex_init(&cond->lock);
+    cond->ticket = 0;
 }
 
-void Cond_wait(thread_cond_t *cond, thread_mutex_t *lock) {
+// Wait on cond, releasing lock while asleep. Waiters are queued in FIFO order:
+// each one takes a ticket from cond, and Cond_signal() grants the oldest ticket.
+// If timeout is non-zero, give up after timeout ticks.
+// Returns 0 if woken by Cond_signal() or Cond_broadcast(), -1 otherwise.
+static int cond_wait(thread_cond_t *cond, thread_mutex_t *lock, int timeout) {
     struct proc *p = myproc();
+    uint ticket, deadline;
+    int r;
 
     if(p == 0)
         panic("sleep");
@@ -32,87 +41,252 @@ void Cond_wait(thread_cond_t *cond, thread_mutex_t *lock) {
     if(lock == 0)
         panic("sleep without lock");
 
-    // Increment number of waiting threads by 1.
-    Mutex_lock(&cond->lock);
+    // The waiter count and tickets are protected by ptable.lock,
+    // the same lock Cond_signal() holds while choosing whom to wake.
+    acquire(&ptable.lock);
     cond->waiting_threads++;
-    Mutex_unlock(&cond->lock);
+    if((ticket = ++cond->ticket) == 0)
+        ticket = ++cond->ticket;
+    deadline = 0;
+    if(timeout > 0 && (deadline = ticks + timeout) == 0)
+        deadline = 1;
 
-    acquire(&ptable.lock);
     // Release lock before going to sleep.
-    Mutex_unlock(lock);
+    mutex_release1(lock);
 
-    // Save condition variable to chan, then go to sleep.
-    p->chan = cond;
-    p->state = SLEEPING;
-
-    sched();
-
-    // Tidy up.
-    p->chan = 0;
+    // Sleep until signaled. Other wakeups on the same channel are spurious.
+    while((r = sleepq(cond, &ptable.lock, ticket, deadline)) < 0) {
+        if(p->killed || (deadline != 0 && (int)(ticks - deadline) >= 0))
+            break;
+    }
+    // A waiter that was not signaled is still counted; remove it.
+    if(r < 0)
+        cond->waiting_threads--;
 
     release(&ptable.lock);
     // Reacquire original lock.
     Mutex_lock(lock);
+    return r;
 }
 
-void Cond_signal(thread_cond_t *cond) {
-    Mutex_lock(&cond->lock);
-    // If there are no waiting threads, return immediately.
-    if(cond->waiting_threads == 0) {
-        Mutex_unlock(&cond->lock);
-        return;
-    }
-    // Decrement the number of waiting threads by 1.
-    cond->waiting_threads--;
-    Mutex_unlock(&cond->lock);
+void Cond_wait(thread_cond_t *cond, thread_mutex_t *lock) {
+    cond_wait(cond, lock, 0);
+}
 
-    struct proc *p;
+int Cond_timedwait(thread_cond_t *cond, thread_mutex_t *lock, int timeout) {
+    if(timeout <= 0)
+        return -1;
+    return cond_wait(cond, lock, timeout);
+}
 
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-        // Search for a thread that is sleeping on the channel which is equal to the condition variable.
-        // Return after waking one thread.
-        if(p->state == SLEEPING && p->chan == cond) {
-            p->state = RUNNABLE;
-            break;
-        }
+void Cond_signal(thread_cond_t *cond) {
+    acquire(&ptable.lock);
+    // Wake the thread that has been waiting the longest, if any.
+    if(cond->waiting_threads > 0)
+        cond->waiting_threads -= wakeupq1(cond, myproc()->pgdir, 1);
+    release(&ptable.lock);
+}
+
+void Cond_broadcast(thread_cond_t *cond) {
+    acquire(&ptable.lock);
+    // Wake every waiting thread in a single pass.
+    if(cond->waiting_threads > 0)
+        cond->waiting_threads -= wakeupq1(cond, myproc()->pgdir, NPROC);
+    release(&ptable.lock);
 }
 
 void Mutex_init(thread_mutex_t *lock) {
     lock->flag = 0;
+    lock->waiters = 0;
+    lock->spins = 0;
+    lock->blocks = 0;
+}
+
+// Return 1 if the LWP recorded in a mutex lock word is running on a CPU.
+static int
+owner_running(int owner)
+{
+    if(owner <= 0 || owner > NPROC)
+        return 0;
+    return ptable.proc[owner - 1].state == RUNNING;
 }
 
+// Adaptive mutex.
+// While the owner is running on another CPU it is likely to release the lock soon,
+// so spin for a while. If the owner is not running (or spinning takes too long),
+// sleep until Mutex_unlock() wakes us up.
 void Mutex_lock(thread_mutex_t *lock) {
-    while(TestAndSet(&lock->flag, 1) == 1);
+    struct proc *p = myproc();
+    int self = (p - ptable.proc) + 1;
+    int owner, i, spun = 0, blocked = 0;
+
+    for(;;) {
+        if((owner = cmpxchg((uint*)&lock->flag, 0, self)) == 0)
+            break;
+
+        // Spin while the owner stays the same and keeps running.
+        for(i = 0; i < MUTEX_SPIN && lock->flag == owner && owner_running(owner); i++)
+            pause();
+        if(lock->flag != owner) {
+            if(i > 0)
+                spun = 1;
+            continue;
+        }
+
+        // Owner is not running. Register as a waiter and sleep.
+        // Incrementing waiters before checking flag pairs with Mutex_unlock(),
+        // which clears flag before checking waiters, so no wakeup is lost.
+        acquire(&ptable.lock);
+        __sync_fetch_and_add(&lock->waiters, 1);
+        if(lock->flag != 0 && !p->killed) {
+            blocked = 1;
+            sleep(lock, &ptable.lock);
+        }
+        __sync_fetch_and_sub(&lock->waiters, 1);
+        release(&ptable.lock);
+
+        // A killed LWP gives up the lock. It exits on its way back to user space.
+        if(p->killed)
+            return;
+    }
+
+    // Record how the lock was obtained. We own the lock, so plain increments are safe.
+    if(blocked)
+        lock->blocks++;
+    else if(spun)
+        lock->spins++;
+}
+
+// Wake up LWPs of the current address space sleeping on the mutex.
+// The ptable lock must be held.
+static void
+mutex_wakeup1(thread_mutex_t *lock)
+{
+    struct proc *p;
+    pde_t *pgdir = myproc()->pgdir;
+
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if(p->state == SLEEPING && p->chan == lock && p->pgdir == pgdir)
+            p->state = RUNNABLE;
+}
+
+// Release the mutex. The ptable lock must be held.
+static void
+mutex_release1(thread_mutex_t *lock)
+{
+    xchg((uint*)&lock->flag, 0);
+    if(lock->waiters > 0)
+        mutex_wakeup1(lock);
 }
 
 void Mutex_unlock(thread_mutex_t *lock) {
-    lock->flag = 0;
+    // xchg is a full barrier: flag is cleared before waiters is read.
+    xchg((uint*)&lock->flag, 0);
+    if(lock->waiters > 0) {
+        acquire(&ptable.lock);
+        mutex_wakeup1(lock);
+        release(&ptable.lock);
+    }
 }
 
-int xem_init(xem_t *semaphore) {
-    semaphore->value = 1;
-    Cond_init(&semaphore->cond);
-    Mutex_init(&semaphore->lock);
+int xem_init(xem_t *semaphore, int value) {
+    if(value < 0)
+        return -1;
+    semaphore->value = value;
+    semaphore->waiting = 0;
+    semaphore->ticket = 0;
     return 0;
 }
 
+// Take one unit if the value is positive. Returns 0 on success.
+int xem_trywait(xem_t *semaphore) {
+    int v;
+
+    while((v = semaphore->value) > 0)
+        if(cmpxchg((uint*)&semaphore->value, v, v - 1) == v)
+            return 0;
+    return -1;
+}
+
+// Wait for a unit, for at most timeout ticks if timeout is non-zero.
+// Sleepers are queued by ticket, and xem_post_n() hands units to the
+// oldest ones directly. The queue is keyed by physical address, so a
+// semaphore in a page shared between processes works across them. Returns 0 once a unit is taken, -1 on timeout or kill.
+static int
+xem_wait_until(xem_t *semaphore, uint timeout)
+{
+    struct proc *p = myproc();
+    void *chan;
+    uint ticket;
+    int r;
+
+    if(xem_trywait(semaphore) == 0)
+        return 0;
+
+    if((chan = waitchan(semaphore)) == 0)
+        return -1;
+    acquire(&ptable.lock);
+    // waiting is raised before the value is checked again; xem_post_n()
+    // raises the value before it reads waiting, so no post is missed.
+    __sync_fetch_and_add(&semaphore->waiting, 1);
+    if(xem_trywait(semaphore) == 0) {
+        __sync_fetch_and_sub(&semaphore->waiting, 1);
+        release(&ptable.lock);
+        return 0;
+    }
+    if((ticket = ++semaphore->ticket) == 0)
+        ticket = ++semaphore->ticket;
+    do {
+        // A granted waiter has been counted out of waiting by the poster.
+        if((r = sleepq(chan, &ptable.lock, ticket, timeout)) == 0)
+            break;
+    } while(!p->killed && (timeout == 0 || (int)(ticks - timeout) < 0));
+    if(r < 0)
+        __sync_fetch_and_sub(&semaphore->waiting, 1);
+    release(&ptable.lock);
+    return r;
+}
+
 int xem_wait(xem_t *semaphore) {
-    Mutex_lock(&semaphore->lock);
-    // If the value of the semaphore is not positive, sleep until the value rises above 0.
-    while (semaphore->value <= 0)
-        Cond_wait(&semaphore->cond, &semaphore->lock);
-    // Decrement the value of the semaphore by 1.
-    semaphore->value--;
-    Mutex_unlock(&semaphore->lock);
+    return xem_wait_until(semaphore, 0);
+}
+
+int xem_timedwait(xem_t *semaphore, int n) {
+    if(n <= 0)
+        return xem_trywait(semaphore);
+    return xem_wait_until(semaphore, ticks + n);
+}
+
+// Add n units and hand them to up to n sleeping waiters, oldest first,
+// in a single pass over the process table.
+int xem_post_n(xem_t *semaphore, int n) {
+    void *chan;
+    int v, k, woken;
+
+    if(n <= 0 || (chan = waitchan(semaphore)) == 0)
+        return -1;
+    __sync_fetch_and_add(&semaphore->value, n);
+    if(semaphore->waiting == 0)
+        return 0;
+
+    acquire(&ptable.lock);
+    // Reserve units for the sleepers; running LWPs may take some meanwhile.
+    do {
+        v = semaphore->value;
+        k = v < semaphore->waiting ? v : semaphore->waiting;
+        if(k <= 0)
+            break;
+    } while(cmpxchg((uint*)&semaphore->value, v, v - k) != v);
+    if(k > 0) {
+        woken = wakeupq1(chan, 0, k);
+        __sync_fetch_and_sub(&semaphore->waiting, woken);
+        if(woken < k)
+            __sync_fetch_and_add(&semaphore->value, k - woken);
+    }
+    release(&ptable.lock);
     return 0;
 }
 
 int xem_unlock(xem_t *semaphore) {
-    Mutex_lock(&semaphore->lock);
-    // Increment the value of the semaphore by 1.
-    semaphore->value++;
-    // Wake up any one thread which is waiting on the condition.
-    Cond_signal(&semaphore->cond);
-    Mutex_unlock(&semaphore->lock);
-    return 0;
+    return xem_post_n(semaphore, 1);
 }
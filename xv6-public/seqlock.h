@@ -0,0 +1,51 @@
+// Sequence locks, for small read-mostly data.
+//
+// A writer makes the sequence number odd, updates the data and makes it
+// even again. Readers never write the lock: they note the sequence number,
+// copy the data, and try again if a writer was active or got in between:
+//
+//   do {
+//     seq = read_seqbegin(&sl);
+//     ... copy the data ...
+//   } while(read_seqretry(&sl, seq));
+//
+// Writers must exclude each other: the kernel holds a spinlock around
+// write_seqbegin()/write_seqend(), user programs use seqlock_write_lock().
+// x86 keeps loads in order and stores in order, so only the compiler
+// has to be kept from moving accesses across these calls.
+
+typedef struct seqlock {
+  volatile uint seq;    // Odd while a writer is updating the data
+  volatile uint lock;   // Serializes writers (seqlock_write_lock)
+} seqlock_t;
+
+static inline uint
+read_seqbegin(seqlock_t *sl)
+{
+  uint seq = sl->seq;
+
+  asm volatile("" : : : "memory");
+  // An odd value can never match in read_seqretry().
+  return seq & ~1;
+}
+
+static inline int
+read_seqretry(seqlock_t *sl, uint seq)
+{
+  asm volatile("" : : : "memory");
+  return sl->seq != seq;
+}
+
+static inline void
+write_seqbegin(seqlock_t *sl)
+{
+  sl->seq++;
+  asm volatile("" : : : "memory");
+}
+
+static inline void
+write_seqend(seqlock_t *sl)
+{
+  asm volatile("" : : : "memory");
+  sl->seq++;
+}
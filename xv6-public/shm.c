@@ -0,0 +1,177 @@
+// Shared memory segments: shmget() and shmrm().
+//
+// A segment is a run of zero-filled pages that any process can attach
+// with shmat() (mmap.c); every attachment maps the same physical pages,
+// so data put there is never copied. Pages are allocated when first
+// touched. Each page holds one reference for the segment and one per
+// page table that maps it, and attachments are passed on by fork and
+// dropped by exit and exec like other mappings.
+//
+// A removed segment can no longer be found or attached, and is freed
+// when the last attachment goes away.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NSHM     32
+#define SHMPAGES (PGSIZE / sizeof(char*))   // Pages in the largest segment
+
+struct shm {
+  int key;                // 0 for a private segment
+  uint npage;
+  int nattach;            // Mappings of the segment, in all processes
+  int removed;
+  char **page;            // Page pointers, in a page of their own; 0 if unused
+};
+
+static struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Free s and its pages. shmtab.lock must be held.
+static void
+shmfree(struct shm *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npage; i++)
+    if(s->page[i])
+      kfree(s->page[i]);
+  kfree((char*)s->page);
+  s->page = 0;
+}
+
+// Return the id of the segment with the given key, making one of
+// size bytes if there is none. Key 0 always makes a new segment.
+// Returns -1 if the segment is too small or no slot or memory is free.
+int
+shmget(int key, uint size)
+{
+  struct shm *s, *free;
+  char **page;
+
+  if(size == 0 || PGROUNDUP(size) / PGSIZE > SHMPAGES)
+    return -1;
+  // Allocated before taking the lock, and given back if not needed.
+  if((page = (char**)kalloc_zeroed()) == 0)
+    return -1;
+  acquire(&shmtab.lock);
+  free = 0;
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(s->page == 0){
+      if(free == 0)
+        free = s;
+    } else if(key != 0 && s->key == key && !s->removed){
+      release(&shmtab.lock);
+      kfree((char*)page);
+      return s->npage * PGSIZE >= size ? s - shmtab.shm : -1;
+    }
+  }
+  if(free == 0){
+    release(&shmtab.lock);
+    kfree((char*)page);
+    return -1;
+  }
+  free->key = key;
+  free->npage = PGROUNDUP(size) / PGSIZE;
+  free->nattach = 0;
+  free->removed = 0;
+  free->page = page;
+  release(&shmtab.lock);
+  return free - shmtab.shm;
+}
+
+// Remove segment id. It is freed now, or when the last process detaches.
+int
+shmrm(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtab.shm[id];
+  acquire(&shmtab.lock);
+  if(s->page == 0 || s->removed){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s->removed = 1;
+  if(s->nattach == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+  return 0;
+}
+
+// Count a new attachment of segment id. Returns the segment, or 0.
+struct shm*
+shmattach(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  s = &shmtab.shm[id];
+  acquire(&shmtab.lock);
+  if(s->page == 0 || s->removed){
+    release(&shmtab.lock);
+    return 0;
+  }
+  s->nattach++;
+  release(&shmtab.lock);
+  return s;
+}
+
+// Count another attachment of s, made by fork.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->nattach++;
+  release(&shmtab.lock);
+}
+
+// Drop an attachment of s, freeing it if it is removed and was the last.
+void
+shmdetach(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(--s->nattach == 0 && s->removed)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+uint
+shmsize(struct shm *s)
+{
+  return s->npage * PGSIZE;
+}
+
+// Return page i of s, allocating it if it was never touched, with a
+// reference for the caller to map. Returns 0 if memory ran out.
+char*
+shmpage(struct shm *s, uint i)
+{
+  char *mem;
+
+  if(i >= s->npage)
+    return 0;
+  acquire(&shmtab.lock);
+  if(s->page[i] == 0 && (s->page[i] = kalloc_zeroed()) == 0){
+    release(&shmtab.lock);
+    return 0;
+  }
+  mem = s->page[i];
+  kref(mem);
+  release(&shmtab.lock);
+  return mem;
+}
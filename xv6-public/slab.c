@@ -0,0 +1,240 @@
+// Object caches: a slab allocator for small kernel objects.
+//
+// Each cache hands out objects of one size, carved from page-sized
+// slabs. A slab starts with a struct slab and holds as many objects as
+// fit after it, so the slab of an object is found by rounding its
+// address down to the page. Slabs with free objects are kept on the
+// cache's partial list; a slab whose objects are all free again goes
+// back to kalloc(), unless it is the cache's last one.
+//
+// A cache may have a constructor, which runs once on every object when
+// its slab is made. Objects are handed out in their constructed state
+// and must be freed in it (with their locks released, say); the free
+// list link lives in a word after the object, so it is not disturbed.
+//
+// As in kalloc(), each CPU keeps a magazine of free objects per cache,
+// used with interrupts off and without the cache lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "x86.h"
+#include "proc.h"
+
+#define NCACHE 8
+#define SMAG   16         // Objects per CPU magazine
+#define SBATCH (SMAG/2)   // Objects moved between a magazine and the slabs at once
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;      // On the partial list
+  struct slab *prev;
+  char *free;             // First free object
+  int inuse;              // Objects out of this slab, magazines included
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+#define SLABOF(o) ((struct slab*)PGROUNDDOWN((uint)(o)))
+#define LINK(c, o) (*(char**)((char*)(o) + (c)->size - sizeof(char*)))
+
+struct smag {
+  int n;
+  void *obj[SMAG];
+} __attribute__((aligned(64)));
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;              // Bytes per object, with the free link
+  int perslab;
+  void (*ctor)(void*);
+  struct slab *partial;   // Slabs with free objects
+  uint nslab;
+  uint nobj;              // Objects out of the slabs, magazines included
+  uint failed;            // Allocations that found no memory
+  struct smag mag[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabtab;
+
+void
+slabinit(void)
+{
+  initlock(&slabtab.lock, "slabtab");
+}
+
+// Make a cache of objects of size bytes, each set up by ctor
+// (if not 0) before it is first handed out.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  size = (size + sizeof(char*) + 7) & ~7;
+  if(size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: too big");
+  acquire(&slabtab.lock);
+  if(slabtab.n == NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabtab.cache[slabtab.n++];
+  release(&slabtab.lock);
+
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->ctor = ctor;
+  return c;
+}
+
+static void
+partial_add(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+partial_remove(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Make a new slab for c and construct its objects.
+// c->lock must be held.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->free = 0;
+  s->inuse = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    o = (char*)s + SLABHDR + i*c->size;
+    if(c->ctor)
+      c->ctor(o);
+    LINK(c, o) = s->free;
+    s->free = o;
+  }
+  partial_add(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Take one object from the slabs of c. c->lock must be held.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+
+  if((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+    return 0;
+  o = s->free;
+  s->free = LINK(c, o);
+  s->inuse++;
+  c->nobj++;
+  if(s->free == 0)
+    partial_remove(c, s);
+  return o;
+}
+
+// Give object o back to its slab. c->lock must be held.
+static void
+slab_put(struct kmem_cache *c, void *o)
+{
+  struct slab *s = SLABOF(o);
+
+  if(s->free == 0)
+    partial_add(c, s);
+  LINK(c, o) = s->free;
+  s->free = o;
+  s->inuse--;
+  c->nobj--;
+  if(s->inuse == 0 && c->nslab > 1){
+    partial_remove(c, s);
+    c->nslab--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate one object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct smag *m;
+  void *o;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < SBATCH && (o = slab_get(c)) != 0)
+      m->obj[m->n++] = o;
+    if(m->n == 0)
+      c->failed++;
+    release(&c->lock);
+  }
+  o = m->n > 0 ? m->obj[--m->n] : 0;
+  popcli();
+  return o;
+}
+
+// Free object o, which came from cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *o)
+{
+  struct smag *m;
+
+  if(SLABOF(o)->cache != c)
+    panic("kmem_cache_free");
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == SMAG){
+    acquire(&c->lock);
+    while(m->n > SBATCH)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  popcli();
+}
+
+// Print every cache's usage on the console (^P).
+void
+slabdump(void)
+{
+  struct kmem_cache *c;
+  int i, cached;
+
+  cprintf("cache\tsize\tslabs\tinuse\tcached\tfailed\n");
+  for(c = slabtab.cache; c < slabtab.cache + slabtab.n; c++){
+    cached = 0;
+    for(i = 0; i < ncpu; i++)
+      cached += c->mag[i].n;
+    cprintf("%s\t%d\t%d\t%d\t%d\t%d\n", c->name, c->size, c->nslab,
+            c->nobj - cached, cached, c->failed);
+  }
+}
@@ -9,6 +9,16 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "lockstat.h"
+
+extern struct {
+  struct spinlock lock;
+  struct proc proc[NPROC];
+} ptable;
+
+// Waiters queue in ticket order and are handed the lock directly by
+// the holder that releases it, so nobody has to race for it on wakeup.
+// Exclusive waiters sleep on lk, shared waiters on &lk->readers.
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -16,18 +26,104 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->waiting = 0;
+  lk->ticket = 0;
   lk->pid = 0;
+  lk->stat = lockstat_register(name, LOCKSTAT_SLEEP);
+  lk->tsc = 0;
+}
+
+// Grant the lock to the waiters at the head of the queue: either the
+// oldest exclusive waiter, or every shared waiter older than it.
+// self, if not null, is a waiter that is awake but still queued.
+// lk->lk and ptable.lock must be held.
+static void
+handoff1(struct sleeplock *lk, struct proc *self)
+{
+  struct proc *p, *head;
+
+  while(lk->waiting > 0 && !lk->locked){
+    head = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+      if((p->state == SLEEPING || p == self) && p->waitticket != 0 &&
+         (p->chan == lk || p->chan == &lk->readers) &&
+         (head == 0 || (int)(p->waitticket - head->waitticket) < 0))
+        head = p;
+    if(head == 0)
+      return;
+    if(head->chan == lk){
+      if(lk->readers > 0)
+        return;
+      lk->locked = 1;
+      lk->pid = head->pid;
+    } else
+      lk->readers++;
+    lk->waiting--;
+    head->waitticket = 0;
+    if(head != self)
+      head->state = RUNNABLE;
+  }
+}
+
+// Queue up on chan until handoff1() grants the lock. lk->lk must be held.
+static void
+waitsleep(struct sleeplock *lk, void *chan)
+{
+  struct proc *p = myproc();
+  uint ticket;
+
+  lk->waiting++;
+  if((ticket = ++lk->ticket) == 0)
+    ticket = ++lk->ticket;
+  // Kernel sleeplocks are not interruptible: a kill just sleeps again.
+  // While we were awake, a release may have found nobody asleep to hand
+  // the lock to, so run the hand-off again with us in the queue first.
+  while(sleepq(chan, &lk->lk, ticket, 0) < 0){
+    acquire(&ptable.lock);
+    p->waitticket = ticket;
+    p->chan = chan;
+    handoff1(lk, p);
+    p->chan = 0;
+    release(&ptable.lock);
+    if(p->waitticket == 0)
+      return;
+    p->waitticket = 0;
+  }
+}
+
+static void
+wakesleep(struct sleeplock *lk)
+{
+  if(lk->waiting > 0){
+    acquire(&ptable.lock);
+    handoff1(lk, 0);
+    release(&ptable.lock);
+  }
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  unsigned long long start;
+  uint pcs[10];
+  int contended;
+
+  start = (lockstat_on && lk->stat) ? rdtsc() : 0;
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  contended = lk->locked || lk->readers > 0 || lk->waiting > 0;
+  if(contended)
+    waitsleep(lk, lk);   // Returns owning the lock.
+  else {
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+  }
+  if(start){
+    if(contended)
+      getcallerpcs(&lk, pcs);
+    lockstat_acquired(lk->stat, contended, rdtsc() - start, contended ? pcs[0] : 0);
+    lk->tsc = rdtsc();
   }
-  lk->locked = 1;
-  lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
@@ -35,9 +131,43 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if(lk->tsc){
+    lockstat_released(lk->stat, rdtsc() - lk->tsc);
+    lk->tsc = 0;
+  }
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakesleep(lk);
+  release(&lk->lk);
+}
+
+// Acquire the lock in shared mode, together with other shared holders.
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  unsigned long long start;
+  int contended;
+
+  start = (lockstat_on && lk->stat) ? rdtsc() : 0;
+  acquire(&lk->lk);
+  contended = lk->locked || lk->waiting > 0;
+  if(contended)
+    waitsleep(lk, &lk->readers);
+  else
+    lk->readers++;
+  if(start)
+    lockstat_acquired(lk->stat, contended, rdtsc() - start, 0);
+  release(&lk->lk);
+}
+
+void
+releasesleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers <= 0)
+    panic("releasesleep_shared");
+  if(--lk->readers == 0)
+    wakesleep(lk);
   release(&lk->lk);
 }
 
@@ -51,6 +181,3 @@ holdingsleep(struct sleeplock *lk)
   release(&lk->lk);
   return r;
 }
-
-
-
@@ -1,7 +1,12 @@
 // Long-term locks for processes
 struct sleeplock {
   uint locked;       // Is the lock held?
+  int readers;       // Holders in shared mode
+  int waiting;       // Processes queued for the lock
+  uint ticket;       // Last FIFO ticket handed to a waiter
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct lockstat *stat;     // Contention statistics (spinlock.c)
+  unsigned long long tsc;    // When it was acquired, while recording
   
   // For debugging:
   char *name;        // Name of lock.
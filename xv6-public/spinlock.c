@@ -8,29 +8,75 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
+
+#define NQNODE 8   // Spinlocks a CPU can hold or wait for at once
+
+static struct qnode qnodes[NCPU][NQNODE];
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->kind = SPIN_MCS;
+  lk->tail = 0;
+  lk->node = 0;
   lk->cpu = 0;
+  lk->stat = lockstat_register(name, LOCKSTAT_SPIN);
+  lk->tsc = 0;
+}
+
+// Take a free queue node of this CPU. Interrupts must be off.
+static struct qnode*
+qalloc(void)
+{
+  struct qnode *q, *pool = qnodes[cpuid()];
+
+  for(q = pool; q < &pool[NQNODE]; q++)
+    if(!q->used){
+      q->used = 1;
+      return q;
+    }
+  panic("qalloc");
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
+// An MCS lock is granted in arrival order and every waiter
+// spins on its own queue node instead of the shared lock word.
 void
 acquire(struct spinlock *lk)
 {
+  struct qnode *q, *pred;
+  unsigned long long start;
+  int contended = 0;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  start = (lockstat_on && lk->stat) ? rdtsc() : 0;
+  if(lk->kind == SPIN_TAS){
+    // The xchg is atomic.
+    while(xchg(&lk->locked, 1) != 0)
+      contended = 1;
+  } else {
+    q = qalloc();
+    q->next = 0;
+    q->wait = 1;
+    pred = (struct qnode*)xchg((volatile uint*)&lk->tail, (uint)q);
+    if(pred){
+      contended = 1;
+      pred->next = q;
+      while(q->wait)
+        pause();
+    }
+    lk->node = q;
+    lk->locked = 1;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,15 +86,26 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+  if(start){
+    lockstat_acquired(lk->stat, contended, rdtsc() - start, lk->pcs[0]);
+    lk->tsc = rdtsc();
+  }
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  struct qnode *q;
+
   if(!holding(lk))
     panic("release");
 
+  if(lk->tsc){
+    lockstat_released(lk->stat, rdtsc() - lk->tsc);
+    lk->tsc = 0;
+  }
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -59,14 +116,58 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  if(lk->kind == SPIN_TAS){
+    // Release the lock, equivalent to lk->locked = 0.
+    // This code can't use a C assignment, since it might
+    // not be atomic. A real OS would use C atomics here.
+    asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  } else {
+    q = lk->node;
+    lk->node = 0;
+    lk->locked = 0;
+    __sync_synchronize();
+    if(q->next == 0){
+      // No known successor: swing tail back to empty, unless
+      // a CPU is just linking itself in behind us.
+      if(cmpxchg((volatile uint*)&lk->tail, (uint)q, 0) != (uint)q)
+        while(q->next == 0)
+          pause();
+    }
+    if(q->next)
+      q->next->wait = 0;
+    q->used = 0;
+  }
 
   popcli();
 }
 
+// Lock contention microbenchmark: n acquire/release pairs on a lock
+// of the given kind shared by every caller, each incrementing a counter.
+// Returns the counter.
+static struct spinlock benchlock[2] = {
+  [SPIN_MCS] { .name = "bench mcs", .kind = SPIN_MCS },
+  [SPIN_TAS] { .name = "bench tas", .kind = SPIN_TAS },
+};
+static uint benchcount[2];
+
+int
+lockbench(int kind, int n)
+{
+  uint count;
+
+  if(kind != SPIN_MCS && kind != SPIN_TAS)
+    return -1;
+  while(n-- > 0){
+    acquire(&benchlock[kind]);
+    benchcount[kind]++;
+    release(&benchlock[kind]);
+  }
+  acquire(&benchlock[kind]);
+  count = benchcount[kind];
+  release(&benchlock[kind]);
+  return count;
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
@@ -124,3 +225,99 @@ popcli(void)
     sti();
 }
 
+//PAGEBREAK!
+// Lock contention statistics.
+//
+// Every spinlock and sleeplock points at the entry for its name, found or
+// created by initlock()/initsleeplock(). While recording is enabled,
+// acquire() and release() report to it. Counters are updated while the
+// lock itself is held, so they are exact for a lock with a unique name
+// and approximate for names shared by many locks (pipe, buffer).
+
+int lockstat_on;
+
+static struct {
+  char *name;            // Claimed with cmpxchg; a string literal
+  struct lockstat st;
+} lockclass[NLOCKSTAT];
+
+// Return the entry for name, creating it if needed.
+// Needs no lock: it runs inside initlock().
+struct lockstat*
+lockstat_register(char *name, int kind)
+{
+  int i;
+
+  for(i = 0; i < NLOCKSTAT; i++){
+    if(lockclass[i].name == 0 &&
+       cmpxchg((volatile uint*)&lockclass[i].name, 0, (uint)name) == 0){
+      safestrcpy(lockclass[i].st.name, name, sizeof(lockclass[i].st.name));
+      lockclass[i].st.kind = kind;
+      return &lockclass[i].st;
+    }
+    if(strncmp(lockclass[i].name, name, sizeof(lockclass[i].st.name)) == 0)
+      return &lockclass[i].st;
+  }
+  return 0;
+}
+
+// Record an acquisition. pc is the caller, used if it had to wait.
+void
+lockstat_acquired(struct lockstat *ls, int contended, unsigned long long wait, uint pc)
+{
+  int i, min;
+
+  ls->acquires++;
+  if(!contended)
+    return;
+  ls->contended++;
+  ls->waitcycles += wait;
+
+  // Keep the most frequent call sites: a new one replaces
+  // the least counted and inherits its count.
+  min = 0;
+  for(i = 0; i < NLOCKPC; i++){
+    if(ls->pc[i] == pc){
+      ls->pccount[i]++;
+      return;
+    }
+    if(ls->pccount[i] < ls->pccount[min])
+      min = i;
+  }
+  ls->pc[min] = pc;
+  ls->pccount[min]++;
+}
+
+void
+lockstat_released(struct lockstat *ls, unsigned long long hold)
+{
+  if(hold > ls->maxhold)
+    ls->maxhold = hold;
+}
+
+// Copy up to n entries to dst and apply flags.
+// Returns the number of entries copied.
+int
+lockstat_snapshot(struct lockstat *dst, int n, int flags)
+{
+  int i, k;
+
+  k = 0;
+  for(i = 0; i < NLOCKSTAT && lockclass[i].name; i++){
+    if(k < n)
+      dst[k++] = lockclass[i].st;
+    if(flags & LOCKSTAT_RESET){
+      lockclass[i].st.acquires = 0;
+      lockclass[i].st.contended = 0;
+      lockclass[i].st.waitcycles = 0;
+      lockclass[i].st.maxhold = 0;
+      memset(lockclass[i].st.pc, 0, sizeof(lockclass[i].st.pc));
+      memset(lockclass[i].st.pccount, 0, sizeof(lockclass[i].st.pccount));
+    }
+  }
+  if(flags & LOCKSTAT_ENABLE)
+    lockstat_on = 1;
+  if(flags & LOCKSTAT_DISABLE)
+    lockstat_on = 0;
+  return k;
+}
@@ -1,6 +1,11 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  int kind;          // SPIN_MCS or SPIN_TAS
+  struct qnode *tail;  // Last CPU queued for an MCS lock
+  struct qnode *node;  // Queue node of the holder
+  struct lockstat *stat;     // Contention statistics (spinlock.c)
+  unsigned long long tsc;    // When it was acquired, while recording
 
   // For debugging:
   char *name;        // Name of lock.
@@ -9,3 +14,13 @@ struct spinlock {
                      // that locked the lock.
 };
 
+#define SPIN_MCS 0   // FIFO queue lock, each waiter spins on its own line (default)
+#define SPIN_TAS 1   // Test-and-set on the lock word
+
+// A waiter in the queue of an MCS lock.
+// Every CPU has a few, one per lock it holds or is waiting for.
+struct qnode {
+  struct qnode *volatile next;
+  volatile uint wait;   // Spin while set; the previous holder clears it
+  uint used;
+} __attribute__((aligned(64)));
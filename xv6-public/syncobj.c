@@ -0,0 +1,162 @@
+// Named semaphores and rwlocks, shared between processes.
+//
+// The objects live in one kernel page that xem_open() and rwlock_open()
+// map at SYNCPAGE in the caller's address space; fork passes the mapping
+// on. The usual xem_* and rwlock_* calls then work on the returned
+// pointers, and since wait queues are keyed by physical address,
+// any process that maps the page can block and wake the others.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define SYNCOBJSIZE 64                     // Bytes per object slot
+#define NSYNCOBJ    (PGSIZE / SYNCOBJSIZE)
+#define SYNCNAME    16                     // Longest name, including the nul
+
+_Static_assert(sizeof(xem_t) <= SYNCOBJSIZE, "xem_t does not fit a slot");
+_Static_assert(sizeof(rwlock_t) <= SYNCOBJSIZE, "rwlock_t does not fit a slot");
+
+#define SYNC_FREE   0
+#define SYNC_XEM    1
+#define SYNC_RWLOCK 2
+
+static struct {
+  struct spinlock lock;
+  char *page;                   // The objects, allocated on first use
+  struct {
+    int type;
+    char name[SYNCNAME];
+  } obj[NSYNCOBJ];
+} synctab;
+
+void
+syncobjinit(void)
+{
+  initlock(&synctab.lock, "syncobj");
+}
+
+// Find the object called name, creating it with the given type if it
+// does not exist, and map the page into the caller.
+// Returns the object's slot, or -1. Sets *created.
+// The caller's address space lock and synctab.lock must be held.
+static int
+syncopen1(char *name, int type, int *created)
+{
+  int i, free = -1;
+
+  *created = 0;
+  if(strlen(name) >= SYNCNAME || strlen(name) == 0)
+    return -1;
+  if(synctab.page == 0 && (synctab.page = kalloc_zeroed()) == 0)
+    return -1;
+  for(i = 0; i < NSYNCOBJ; i++){
+    if(synctab.obj[i].type == SYNC_FREE){
+      if(free < 0)
+        free = i;
+    } else if(strncmp(synctab.obj[i].name, name, SYNCNAME) == 0)
+      break;
+  }
+  if(i == NSYNCOBJ){
+    if(free < 0)
+      return -1;
+    i = free;
+  } else if(synctab.obj[i].type != type)
+    return -1;
+  if(mapshared(myproc()->pgdir, SYNCPAGE, synctab.page) < 0)
+    return -1;
+  if(synctab.obj[i].type == SYNC_FREE){
+    synctab.obj[i].type = type;
+    safestrcpy(synctab.obj[i].name, name, SYNCNAME);
+    memset(synctab.page + i * SYNCOBJSIZE, 0, SYNCOBJSIZE);
+    *created = 1;
+  }
+  return i;
+}
+
+// Open the object called name, creating it with the given type if it
+// does not exist. Sets *k to its kernel address and returns its user
+// address, or 0. A new object is left for the caller to initialize,
+// with both locks still held; syncopened() releases them.
+static char*
+syncopen(char *name, int type, char **k, int *created)
+{
+  int i;
+
+  // The address space lock comes first: it is a sleep lock, and the
+  // page directory entry of SYNCPAGE also covers the top of the mmap
+  // area, which other LWPs may be faulting in meanwhile.
+  acquirevm(myproc());
+  acquire(&synctab.lock);
+  if((i = syncopen1(name, type, created)) < 0){
+    release(&synctab.lock);
+    releasevm(myproc());
+    return 0;
+  }
+  *k = synctab.page + i * SYNCOBJSIZE;
+  return (char*)SYNCPAGE + i * SYNCOBJSIZE;
+}
+
+static void
+syncopened(void)
+{
+  release(&synctab.lock);
+  releasevm(myproc());
+}
+
+// Open the semaphore called name, creating it with value units.
+xem_t*
+xem_open(char *name, int value)
+{
+  char *sem, *k;
+  int created;
+
+  if(value < 0 || (sem = syncopen(name, SYNC_XEM, &k, &created)) == 0)
+    return 0;
+  if(created)
+    xem_init((xem_t*)k, value);
+  syncopened();
+  return (xem_t*)sem;
+}
+
+// Open the rwlock called name, creating it with the given policy.
+rwlock_t*
+rwlock_open(char *name, int mode)
+{
+  char *rw, *k;
+  int created;
+
+  if(mode != RWLOCK_READER_PREF && mode != RWLOCK_WRITER_PREF && mode != RWLOCK_PHASE_FAIR)
+    return 0;
+  if((rw = syncopen(name, SYNC_RWLOCK, &k, &created)) == 0)
+    return 0;
+  if(created)
+    rwlock_init_mode((rwlock_t*)k, mode);
+  syncopened();
+  return (rwlock_t*)rw;
+}
+
+// Remove name. Its slot may be reused by the next open,
+// so nobody may be using the object any more.
+int
+sync_unlink(char *name)
+{
+  int i;
+
+  acquire(&synctab.lock);
+  for(i = 0; i < NSYNCOBJ; i++){
+    if(synctab.obj[i].type != SYNC_FREE &&
+       strncmp(synctab.obj[i].name, name, SYNCNAME) == 0){
+      synctab.obj[i].type = SYNC_FREE;
+      release(&synctab.lock);
+      return 0;
+    }
+  }
+  release(&synctab.lock);
+  return -1;
+}
@@ -21,26 +21,31 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(uvmtouch(addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
-// Returns length of string, not including nul.
+// Fetch the nul-terminated string at addr from the current process
+// into buf, which holds max bytes. The kernel works on the copy: the
+// user's string may change or go away meanwhile.
+// Returns length of string, not including nul, or -1.
 int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
-  char *s, *ep;
   struct proc *curproc = myproc();
+  uint a;
+  int i;
 
-  if(addr >= curproc->sz)
-    return -1;
-  *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
+  for(i = 0; i < max; i++){
+    a = addr + i;
+    if(a >= curproc->sz)
+      return -1;
+    if((i == 0 || a % PGSIZE == 0) && uvmtouch(a, 1, 0) < 0)
+      return -1;
+    if((buf[i] = *(char*)a) == 0)
+      return i;
   }
   return -1;
 }
@@ -52,34 +57,78 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+argptr1(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0)
+    return -1;
+  // Above the process size, only file mappings and mapped shared
+  // pages are valid.
+  if(((uint)i >= curproc->sz || (uint)i+size > curproc->sz) &&
+     !mmapped(curproc, i, size) && !uvmmapped(curproc->pgdir, i, size))
+    return -1;
+  if(uvmtouch(i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space, and that the kernel
+// may write through it.
+int
+argptr(int n, char **pp, int size)
+{
+  return argptr1(n, pp, size, 1);
+}
+
+// Like argptr(), for a block that the kernel only reads, which
+// may be read-only memory such as a PROT_READ file mapping.
+int
+argptr_read(int n, char **pp, int size)
+{
+  return argptr1(n, pp, size, 0);
+}
+
+// Like argptr(), for a synchronization object, which the kernel
+// updates with ptable.lock held. *pp is set to the kernel address of
+// the object, whose page stays pinned until the system call returns
+// (see uvmsync()).
+int
+argsync(int n, char **pp, int size)
+{
+  struct proc *curproc = myproc();
+  char *ka;
+
+  if(curproc->npinned >= NELEM(curproc->pinned))
+    panic("argsync");
+  if(argptr1(n, pp, size, 1) < 0)
+    return -1;
+  if(uvmsync((uint)*pp, size, &ka) < 0)
+    return -1;
+  curproc->pinned[curproc->npinned++] = (char*)PGROUNDDOWN((uint)ka);
+  *pp = ka;
+  return 0;
+}
+
+// Fetch the nth word-sized system call argument as a string pointer,
+// and copy the string into buf, which holds max bytes.
+// It is copied rather than used in place because other LWPs, and
+// other processes through shared memory or file mappings, can change
+// user memory while the kernel uses it.
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
   int addr;
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -128,6 +177,28 @@ extern int sys_rwlock_release_readlock(void);
 extern int sys_rwlock_release_writelock(void);
 extern int sys_pread(void);
 extern int sys_pwrite(void);
+extern int sys_Cond_broadcast(void);
+extern int sys_Cond_timedwait(void);
+extern int sys_barrier_init(void);
+extern int sys_barrier_wait(void);
+extern int sys_getncpu(void);
+extern int sys_rwlock_init_mode(void);
+extern int sys_lockbench(void);
+extern int sys_lockstat(void);
+extern int sys_xem_trywait(void);
+extern int sys_xem_timedwait(void);
+extern int sys_xem_post_n(void);
+extern int sys_xem_open(void);
+extern int sys_rwlock_open(void);
+extern int sys_sync_unlink(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_shmrm(void);
+extern int sys_superpages(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -176,6 +247,28 @@ static int (*syscalls[])(void) = {
 [SYS_rwlock_release_writelock] sys_rwlock_release_writelock,
 [SYS_pread] sys_pread,
 [SYS_pwrite] sys_pwrite,
+[SYS_Cond_broadcast] sys_Cond_broadcast,
+[SYS_Cond_timedwait] sys_Cond_timedwait,
+[SYS_barrier_init] sys_barrier_init,
+[SYS_barrier_wait] sys_barrier_wait,
+[SYS_getncpu] sys_getncpu,
+[SYS_rwlock_init_mode] sys_rwlock_init_mode,
+[SYS_lockbench] sys_lockbench,
+[SYS_lockstat] sys_lockstat,
+[SYS_xem_trywait] sys_xem_trywait,
+[SYS_xem_timedwait] sys_xem_timedwait,
+[SYS_xem_post_n] sys_xem_post_n,
+[SYS_xem_open] sys_xem_open,
+[SYS_rwlock_open] sys_rwlock_open,
+[SYS_sync_unlink] sys_sync_unlink,
+[SYS_mmap] sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_msync] sys_msync,
+[SYS_shmget] sys_shmget,
+[SYS_shmat] sys_shmat,
+[SYS_shmdt] sys_shmdt,
+[SYS_shmrm] sys_shmrm,
+[SYS_superpages] sys_superpages,
 };
 
 void
@@ -187,6 +280,9 @@ syscall(void)
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
+    // Drop the pages argsync() pinned for the call.
+    while(curproc->npinned > 0)
+      kfree(curproc->pinned[--curproc->npinned]);
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
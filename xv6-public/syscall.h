@@ -45,3 +45,25 @@
 #define SYS_rwlock_release_writelock 44
 #define SYS_pread 45
 #define SYS_pwrite 46
+#define SYS_Cond_broadcast 47
+#define SYS_Cond_timedwait 48
+#define SYS_barrier_init 49
+#define SYS_barrier_wait 50
+#define SYS_getncpu 51
+#define SYS_rwlock_init_mode 52
+#define SYS_lockbench 53
+#define SYS_lockstat 54
+#define SYS_xem_trywait 55
+#define SYS_xem_timedwait 56
+#define SYS_xem_post_n 57
+#define SYS_xem_open 58
+#define SYS_rwlock_open 59
+#define SYS_sync_unlink 60
+#define SYS_mmap 61
+#define SYS_munmap 62
+#define SYS_msync 63
+#define SYS_shmget 64
+#define SYS_shmat 65
+#define SYS_shmdt 66
+#define SYS_shmrm 67
+#define SYS_superpages 68
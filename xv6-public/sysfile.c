@@ -85,7 +85,7 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr_read(1, &p, n) < 0)
     return -1;
   return filewrite(f, p, n);
 }
@@ -110,12 +110,49 @@ sys_pwrite(void)
     int n, off;
     void* addr;
 
-    if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, (void*)&addr, n) < 0 || argint(3, &off) < 0)
+    if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr_read(1, (void*)&addr, n) < 0 || argint(3, &off) < 0)
         return -1;
 
     return pwrite(f, addr, n, off);
 }
 
+int
+sys_mmap(void)
+{
+    struct file *f;
+    int off, len, prot, flags;
+
+    if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0 ||
+       argint(3, &prot) < 0 || argint(4, &flags) < 0)
+        return 0;
+    if(off < 0 || len <= 0)
+        return 0;
+
+    return mmap(f, off, len, prot, flags);
+}
+
+int
+sys_munmap(void)
+{
+    int addr, len;
+
+    if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+        return -1;
+
+    return munmap(addr, len);
+}
+
+int
+sys_msync(void)
+{
+    int addr, len;
+
+    if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+        return -1;
+
+    return msync(addr, len);
+}
+
 int
 sys_close(void)
 {
@@ -144,10 +181,10 @@ sys_fstat(void)
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
-  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+  if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
   begin_op();
@@ -212,10 +249,10 @@ sys_unlink(void)
 {
   struct inode *ip, *dp;
   struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ], path[MAXPATH];
   uint off;
 
-  if(argstr(0, &path) < 0)
+  if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
   begin_op();
@@ -311,12 +348,12 @@ create(char *path, short type, short major, short minor)
 int
 sys_open(void)
 {
-  char *path;
+  char path[MAXPATH];
   int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
     return -1;
 
   begin_op();
@@ -361,11 +398,11 @@ sys_open(void)
 int
 sys_mkdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -378,11 +415,11 @@ int
 sys_mknod(void)
 {
   struct inode *ip;
-  char *path;
+  char path[MAXPATH];
   int major, minor;
 
   begin_op();
-  if((argstr(0, &path)) < 0 ||
+  if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
      (ip = create(path, T_DEV, major, minor)) == 0){
@@ -397,12 +434,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
   struct proc *curproc = myproc();
   
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
   }
@@ -422,27 +459,34 @@ sys_chdir(void)
 int
 sys_exec(void)
 {
-  char *path, *argv[MAXARG];
-  int i;
+  char path[MAXPATH], *argv[MAXARG];
+  int i, r;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, (int*)&uargv) < 0){
     return -1;
   }
+  // The arguments are copied into pages of their own.
   memset(argv, 0, sizeof(argv));
+  r = -1;
   for(i=0;; i++){
     if(i >= NELEM(argv))
-      return -1;
+      goto out;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
-      return -1;
+      goto out;
     if(uarg == 0){
       argv[i] = 0;
       break;
     }
-    if(fetchstr(uarg, &argv[i]) < 0)
-      return -1;
+    if((argv[i] = kalloc()) == 0 || fetchstr(uarg, argv[i], PGSIZE) < 0)
+      goto out;
   }
-  return exec(path, argv);
+  r = exec(path, argv);
+
+ out:
+  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+    kfree(argv[i]);
+  return r;
 }
 
 int
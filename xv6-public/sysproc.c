@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "seqlock.h"
+#include "lockstat.h"
 
 int
 sys_fork(void)
@@ -68,6 +70,40 @@ sys_yield(void)     // This function is called when user calls yield(), not time
     return 0;
 }
 
+// Return the number of CPUs.
+int
+sys_getncpu(void)
+{
+    return ncpu;
+}
+
+// Run the kernel spinlock contention benchmark.
+int
+sys_lockbench(void)
+{
+    int kind, n;
+
+    if(argint(0, &kind) < 0 || argint(1, &n) < 0)
+        return -1;
+    return lockbench(kind, n);
+}
+
+// Copy lock contention statistics to user memory.
+int
+sys_lockstat(void)
+{
+    struct lockstat *buf;
+    int n, flags;
+
+    if(argint(1, &n) < 0 || n < 0 || argint(2, &flags) < 0)
+        return -1;
+    if(n > NLOCKSTAT)
+        n = NLOCKSTAT;
+    if(argptr(0, (void*)&buf, n * sizeof(struct lockstat)) < 0)
+        return -1;
+    return lockstat_snapshot(buf, n, flags);
+}
+
 int
 sys_getlev(void)
 {
@@ -91,12 +127,14 @@ sys_set_cpu_share(void)
 int
 sys_thread_create(void)
 {
-    int thread, start_routine, arg;
+    thread_t *thread;
+    int start_routine, arg;
 
-    if( (argint(0, &thread) < 0) || (argint(1, &start_routine) < 0) || (argint(2, &arg) < 0) )
+    // argptr() also makes the page that receives the thread ID private.
+    if( (argptr(0, (void*)&thread, sizeof(thread_t)) < 0) || (argint(1, &start_routine) < 0) || (argint(2, &arg) < 0) )
         return -1;
 
-    return thread_create((thread_t*)thread, (void*)start_routine, (void*)arg);
+    return thread_create(thread, (void*)start_routine, (void*)arg);
 }
 
 int
@@ -114,12 +152,13 @@ sys_thread_exit(void)
 int
 sys_thread_join(void)
 {
-    int thread, retval;
+    int thread;
+    void **retval;
 
-    if( (argint(0, &thread) < 0) || (argint(1, &retval) < 0) )
+    if( (argint(0, &thread) < 0) || (argptr(1, (void*)&retval, sizeof(void*)) < 0) )
         return -1;
 
-    return thread_join((thread_t)thread, (void**)retval);
+    return thread_join((thread_t)thread, retval);
 }
 
 int
@@ -131,16 +170,22 @@ sys_sbrk(void)
   if(argint(0, &n) < 0)
     return -1;
 
-  // Set addr as manager process's sz.
+  if(myproc()->tid < 0)
+      return -1;
+
+  // Set addr as manager process's sz. Another LWP must not
+  // grow the address space between reading it and growing.
+  acquirevm(myproc());
   if(myproc()->tid > 0)
       addr = myproc()->manager->sz;
-  else if(myproc()->tid == 0)
-      addr = myproc()->sz;
   else
-      return -1;
+      addr = myproc()->sz;
 
-  if(growproc(n) < 0)
+  if(growproc(n) < 0) {
+    releasevm(myproc());
     return -1;
+  }
+  releasevm(myproc());
   return addr;
 }
 
@@ -170,11 +215,12 @@ sys_sleep(void)
 int
 sys_uptime(void)
 {
-  uint xticks;
+  uint xticks, seq;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
+  do {
+    seq = read_seqbegin(&tickseq);
+    xticks = ticks;
+  } while(read_seqretry(&tickseq, seq));
   return xticks;
 }
 
@@ -196,7 +242,7 @@ sys_Cond_init(void)
 {
     thread_cond_t *cond;
 
-    if(argptr(0, (void*)&cond, sizeof(thread_cond_t*)) < 0)
+    if(argsync(0, (void*)&cond, sizeof(thread_cond_t)) < 0)
         return -1;
 
     Cond_init(cond);
@@ -209,9 +255,9 @@ sys_Cond_wait(void)
     thread_cond_t *cond;
     thread_mutex_t *lock;
 
-    if(argptr(0, (void*)&cond, sizeof(thread_cond_t*)) < 0)
+    if(argsync(0, (void*)&cond, sizeof(thread_cond_t)) < 0)
         return -1;
-    if(argptr(1, (void*)&lock, sizeof(thread_mutex_t*)) < 0)
+    if(argsync(1, (void*)&lock, sizeof(thread_mutex_t)) < 0)
         return -1;
 
     Cond_wait(cond, lock);
@@ -223,19 +269,48 @@ sys_Cond_signal(void)
 {
     thread_cond_t *cond;
 
-    if(argptr(0, (void*)&cond, sizeof(thread_cond_t*)) < 0)
+    if(argsync(0, (void*)&cond, sizeof(thread_cond_t)) < 0)
         return -1;
 
     Cond_signal(cond);
     return 0;
 }
 
+int
+sys_Cond_broadcast(void)
+{
+    thread_cond_t *cond;
+
+    if(argsync(0, (void*)&cond, sizeof(thread_cond_t)) < 0)
+        return -1;
+
+    Cond_broadcast(cond);
+    return 0;
+}
+
+int
+sys_Cond_timedwait(void)
+{
+    thread_cond_t *cond;
+    thread_mutex_t *lock;
+    int timeout;
+
+    if(argsync(0, (void*)&cond, sizeof(thread_cond_t)) < 0)
+        return -1;
+    if(argsync(1, (void*)&lock, sizeof(thread_mutex_t)) < 0)
+        return -1;
+    if(argint(2, &timeout) < 0)
+        return -1;
+
+    return Cond_timedwait(cond, lock, timeout);
+}
+
 int
 sys_Mutex_init(void)
 {
     thread_mutex_t *lock;
 
-    if(argptr(0, (void*)&lock, sizeof(thread_mutex_t*)) < 0)
+    if(argsync(0, (void*)&lock, sizeof(thread_mutex_t)) < 0)
         return -1;
 
     Mutex_init(lock);
@@ -247,7 +322,7 @@ sys_Mutex_lock(void)
 {
     thread_mutex_t *lock;
 
-    if(argptr(0, (void*)&lock, sizeof(thread_mutex_t*)) < 0)
+    if(argsync(0, (void*)&lock, sizeof(thread_mutex_t)) < 0)
         return -1;
 
     Mutex_lock(lock);
@@ -259,7 +334,7 @@ sys_Mutex_unlock(void)
 {
     thread_mutex_t *lock;
 
-    if(argptr(0, (void*)&lock, sizeof(thread_mutex_t*)) < 0)
+    if(argsync(0, (void*)&lock, sizeof(thread_mutex_t)) < 0)
         return -1;
 
     Mutex_unlock(lock);
@@ -270,11 +345,12 @@ int
 sys_xem_init(void)
 {
     xem_t *semaphore;
+    int value;
 
-    if(argptr(0, (void*)&semaphore, sizeof(xem_t*)) < 0)
+    if(argsync(0, (void*)&semaphore, sizeof(xem_t)) < 0 || argint(1, &value) < 0)
         return -1;
 
-    return xem_init(semaphore);
+    return xem_init(semaphore, value);
 }
 
 int
@@ -282,40 +358,177 @@ sys_xem_wait(void)
 {
     xem_t *semaphore;
 
-    if(argptr(0, (void*)&semaphore, sizeof(xem_t*)) < 0)
+    if(argsync(0, (void*)&semaphore, sizeof(xem_t)) < 0)
         return -1;
 
     return xem_wait(semaphore);
 }
 
+int
+sys_xem_trywait(void)
+{
+    xem_t *semaphore;
+
+    if(argsync(0, (void*)&semaphore, sizeof(xem_t)) < 0)
+        return -1;
+
+    return xem_trywait(semaphore);
+}
+
+int
+sys_xem_timedwait(void)
+{
+    xem_t *semaphore;
+    int n;
+
+    if(argsync(0, (void*)&semaphore, sizeof(xem_t)) < 0 || argint(1, &n) < 0)
+        return -1;
+
+    return xem_timedwait(semaphore, n);
+}
+
+int
+sys_xem_post_n(void)
+{
+    xem_t *semaphore;
+    int n;
+
+    if(argsync(0, (void*)&semaphore, sizeof(xem_t)) < 0 || argint(1, &n) < 0)
+        return -1;
+
+    return xem_post_n(semaphore, n);
+}
+
 int
 sys_xem_unlock(void)
 {
     xem_t *semaphore;
 
-    if(argptr(0, (void*)&semaphore, sizeof(xem_t*)) < 0)
+    if(argsync(0, (void*)&semaphore, sizeof(xem_t)) < 0)
         return -1;
 
     return xem_unlock(semaphore);
 }
 
+int
+sys_xem_open(void)
+{
+    char name[MAXPATH];
+    int value;
+
+    if(argstr(0, name, MAXPATH) < 0 || argint(1, &value) < 0)
+        return 0;
+
+    return (int)xem_open(name, value);
+}
+
+int
+sys_rwlock_open(void)
+{
+    char name[MAXPATH];
+    int mode;
+
+    if(argstr(0, name, MAXPATH) < 0 || argint(1, &mode) < 0)
+        return 0;
+
+    return (int)rwlock_open(name, mode);
+}
+
+int
+sys_sync_unlink(void)
+{
+    char name[MAXPATH];
+
+    if(argstr(0, name, MAXPATH) < 0)
+        return -1;
+
+    return sync_unlink(name);
+}
+
+int
+sys_shmget(void)
+{
+    int key, size;
+
+    if(argint(0, &key) < 0 || argint(1, &size) < 0 || size <= 0)
+        return -1;
+
+    return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+    int id;
+
+    if(argint(0, &id) < 0)
+        return 0;
+
+    return shmat(id);
+}
+
+int
+sys_shmdt(void)
+{
+    int addr;
+
+    if(argint(0, &addr) < 0)
+        return -1;
+
+    return shmdt(addr);
+}
+
+int
+sys_shmrm(void)
+{
+    int id;
+
+    if(argint(0, &id) < 0)
+        return -1;
+
+    return shmrm(id);
+}
+
+int
+sys_superpages(void)
+{
+    int on;
+
+    if(argint(0, &on) < 0)
+        return -1;
+
+    return superpages(on);
+}
+
 int
 sys_rwlock_init(void)
 {
     rwlock_t *rwlock;
 
-    if(argptr(0, (void*)&rwlock, sizeof(rwlock_t*)) < 0)
+    if(argsync(0, (void*)&rwlock, sizeof(rwlock_t)) < 0)
         return -1;
 
     return rwlock_init(rwlock);
 }
 
+int
+sys_rwlock_init_mode(void)
+{
+    rwlock_t *rwlock;
+    int mode;
+
+    if(argsync(0, (void*)&rwlock, sizeof(rwlock_t)) < 0 || argint(1, &mode) < 0)
+        return -1;
+
+    return rwlock_init_mode(rwlock, mode);
+}
+
 int
 sys_rwlock_acquire_readlock(void)
 {
     rwlock_t *rwlock;
 
-    if(argptr(0, (void*)&rwlock, sizeof(rwlock_t*)) < 0)
+    if(argsync(0, (void*)&rwlock, sizeof(rwlock_t)) < 0)
         return -1;
 
     return rwlock_acquire_readlock(rwlock);
@@ -326,7 +539,7 @@ sys_rwlock_acquire_writelock(void)
 {
     rwlock_t *rwlock;
 
-    if(argptr(0, (void*)&rwlock, sizeof(rwlock_t*)) < 0)
+    if(argsync(0, (void*)&rwlock, sizeof(rwlock_t)) < 0)
         return -1;
 
     return rwlock_acquire_writelock(rwlock);
@@ -337,7 +550,7 @@ sys_rwlock_release_readlock(void)
 {
     rwlock_t *rwlock;
 
-    if(argptr(0, (void*)&rwlock, sizeof(rwlock_t*)) < 0)
+    if(argsync(0, (void*)&rwlock, sizeof(rwlock_t)) < 0)
         return -1;
 
     return rwlock_release_readlock(rwlock);
@@ -348,9 +561,33 @@ sys_rwlock_release_writelock(void)
 {
     rwlock_t *rwlock;
 
-    if(argptr(0, (void*)&rwlock, sizeof(rwlock_t*)) < 0)
+    if(argsync(0, (void*)&rwlock, sizeof(rwlock_t)) < 0)
         return -1;
 
     return rwlock_release_writelock(rwlock);
 }
 
+int
+sys_barrier_init(void)
+{
+    barrier_t *barrier;
+    int n;
+
+    if(argsync(0, (void*)&barrier, sizeof(barrier_t)) < 0)
+        return -1;
+    if(argint(1, &n) < 0)
+        return -1;
+
+    return barrier_init(barrier, n);
+}
+
+int
+sys_barrier_wait(void)
+{
+    barrier_t *barrier;
+
+    if(argsync(0, (void*)&barrier, sizeof(barrier_t)) < 0)
+        return -1;
+
+    return barrier_wait(barrier);
+}
@@ -0,0 +1,348 @@
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "tls.h"
+#include "task.h"
+
+#define MAXWORKERS 16
+#define DEQUESIZE  1024       // Tasks per deque, a power of two
+#define IDLESPIN   2000       // Failed steal rounds before an idle worker sleeps
+#define STEALSTACK 2048       // Stack bytes in use above which sync() stops stealing
+
+// Chase-Lev work-stealing deque.
+// Only the owner touches bottom; thieves race on top with cmpxchg.
+struct deque {
+  volatile uint top;
+  volatile uint bottom;
+  task_t *tasks[DEQUESIZE];
+};
+
+struct worker {
+  int id;
+  uint seed;                  // Victim selection
+  thread_t tid;
+  struct deque dq;
+};
+
+static struct worker *workers;
+static int nworkers;
+static volatile int done;
+static volatile uint nsleeping;  // Workers asleep (or about to sleep) on idle
+static xem_t idle;
+
+static struct worker*
+myworker(void)
+{
+  return thread_tls()->worker;
+}
+
+// Push t on the bottom of the owner's deque. Returns -1 if it is full.
+static int
+push(struct deque *dq, task_t *t)
+{
+  uint b = dq->bottom;
+
+  if(b - dq->top >= DEQUESIZE)
+    return -1;
+  dq->tasks[b & (DEQUESIZE - 1)] = t;
+  asm volatile("" : : : "memory");
+  dq->bottom = b + 1;
+  return 0;
+}
+
+// Pop the newest task from the owner's deque.
+static task_t*
+pop(struct deque *dq)
+{
+  uint b, t;
+  task_t *task;
+
+  b = dq->bottom - 1;
+  dq->bottom = b;
+  mfence();
+  t = dq->top;
+  if((int)(b - t) < 0) {
+    dq->bottom = b + 1;
+    return 0;
+  }
+  task = dq->tasks[b & (DEQUESIZE - 1)];
+  if(b == t) {
+    // Last task: race the thieves for it.
+    if(cmpxchg(&dq->top, t, t + 1) != t)
+      task = 0;
+    dq->bottom = t + 1;
+  }
+  return task;
+}
+
+// Take the oldest task from another worker's deque.
+static task_t*
+steal(struct deque *dq)
+{
+  uint t, b;
+  task_t *task;
+
+  t = dq->top;
+  asm volatile("" : : : "memory");
+  b = dq->bottom;
+  if((int)(b - t) <= 0)
+    return 0;
+  task = dq->tasks[t & (DEQUESIZE - 1)];
+  if(cmpxchg(&dq->top, t, t + 1) != t)
+    return 0;
+  return task;
+}
+
+// Try every other worker once, starting at a random victim.
+static task_t*
+steal_any(struct worker *w)
+{
+  task_t *task;
+  int i, v;
+
+  w->seed ^= w->seed << 13;
+  w->seed ^= w->seed >> 17;
+  w->seed ^= w->seed << 5;
+  v = w->seed % nworkers;
+  for(i = 0; i < nworkers; i++, v = (v + 1) % nworkers) {
+    if(v == w->id)
+      continue;
+    if((task = steal(&workers[v].dq)) != 0)
+      return task;
+  }
+  return 0;
+}
+
+static int
+have_work(void)
+{
+  int i;
+
+  for(i = 0; i < nworkers; i++)
+    if((int)(workers[i].dq.bottom - workers[i].dq.top) > 0)
+      return 1;
+  return 0;
+}
+
+// The task's memory may be reused as soon as pending drops,
+// so it is not touched after that.
+static void
+run(task_t *t)
+{
+  t->fn(t->arg);
+  fetch_add(&t->group->pending, -1);
+}
+
+// Wake one sleeping worker, if any.
+static void
+wake_one(void)
+{
+  uint n;
+
+  while((n = nsleeping) > 0) {
+    if(cmpxchg(&nsleeping, n, n - 1) == n) {
+      xem_unlock(&idle);
+      return;
+    }
+  }
+}
+
+// Sleep until a spawn() or task_exit() posts the idle semaphore.
+// nsleeping is raised before the deques are checked one last time, and
+// spawn() reads it after publishing its task, so a wakeup cannot be lost.
+static void
+idle_sleep(void)
+{
+  uint n;
+
+  fetch_add((volatile int*)&nsleeping, 1);
+  if(have_work() || done) {
+    // Undo, unless a spawner already consumed our count; then a spare
+    // post is left behind and only costs someone a spurious wakeup.
+    while((n = nsleeping) > 0)
+      if(cmpxchg(&nsleeping, n, n - 1) == n)
+        return;
+    return;
+  }
+  xem_wait(&idle);
+}
+
+static void*
+worker_main(void *arg)
+{
+  struct worker *w = arg;
+  task_t *t;
+  int spin = 0;
+
+  thread_tls()->worker = w;
+  while(!done) {
+    if((t = pop(&w->dq)) != 0 || (t = steal_any(w)) != 0) {
+      run(t);
+      spin = 0;
+    } else if(++spin < IDLESPIN) {
+      pause();
+    } else {
+      idle_sleep();
+      spin = 0;
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Start the runtime with n workers, or one per CPU if n is 0.
+// The calling thread becomes worker 0.
+int
+task_init(int n)
+{
+  int i;
+
+  if(workers != 0)
+    return -1;
+  if(n <= 0)
+    n = getncpu();
+  if(n > MAXWORKERS)
+    n = MAXWORKERS;
+  if((workers = malloc(n * sizeof(struct worker))) == 0)
+    return -1;
+  memset(workers, 0, n * sizeof(struct worker));
+  nworkers = n;
+  done = 0;
+  nsleeping = 0;
+  xem_init(&idle, 0);
+
+  for(i = 0; i < n; i++) {
+    workers[i].id = i;
+    workers[i].seed = 2463534242U + i * 7919;
+  }
+  thread_tls()->worker = &workers[0];
+  for(i = 1; i < n; i++) {
+    if(thread_create(&workers[i].tid, worker_main, &workers[i]) < 0) {
+      nworkers = i;
+      task_exit();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Stop the workers. Every task group must have been synced.
+void
+task_exit(void)
+{
+  void *ret;
+  int i;
+
+  if(workers == 0)
+    return;
+  done = 1;
+  for(i = 1; i < nworkers; i++)
+    xem_unlock(&idle);
+  for(i = 1; i < nworkers; i++)
+    thread_join(workers[i].tid, &ret);
+  thread_tls()->worker = 0;
+  free(workers);
+  workers = 0;
+  nworkers = 0;
+}
+
+int
+task_nworkers(void)
+{
+  return nworkers;
+}
+
+// Queue fn(arg) to run as part of group. Outside the runtime,
+// or if the caller's deque is full, the task runs right away.
+void
+spawn(taskgroup_t *group, task_t *t, void (*fn)(void*), void *arg)
+{
+  struct worker *w = myworker();
+
+  t->fn = fn;
+  t->arg = arg;
+  t->group = group;
+  fetch_add(&group->pending, 1);
+  if(w == 0 || push(&w->dq, t) < 0) {
+    run(t);
+    return;
+  }
+  mfence();
+  if(nsleeping > 0)
+    wake_one();
+}
+
+// Wait for every task spawned into group. Meanwhile the caller runs
+// tasks from its own deque and, while it has stack to spare, steals.
+void
+sync(taskgroup_t *group)
+{
+  struct worker *w = myworker();
+  task_t *t;
+  char here;
+
+  while(group->pending > 0) {
+    if(w == 0) {
+      yield();
+      continue;
+    }
+    if((t = pop(&w->dq)) != 0)
+      run(t);
+    else if((uint)thread_tls() - (uint)&here < STEALSTACK && (t = steal_any(w)) != 0)
+      run(t);
+    else
+      pause();
+  }
+}
+
+struct range {
+  int lo, hi, grain;
+  void (*body)(int, int, void*);
+  void *arg;
+};
+
+static void
+range_task(void *arg)
+{
+  struct range *r = arg;
+  struct range right;
+  taskgroup_t group;
+  task_t t;
+  int mid;
+
+  if(r->hi - r->lo <= r->grain) {
+    r->body(r->lo, r->hi, r->arg);
+    return;
+  }
+  // Offer the upper half to thieves and work on the lower half.
+  mid = r->lo + (r->hi - r->lo) / 2;
+  right = *r;
+  right.lo = mid;
+  r->hi = mid;
+  group.pending = 0;
+  spawn(&group, &t, range_task, &right);
+  range_task(r);
+  sync(&group);
+}
+
+// Call body on disjoint subranges of [lo, hi) of at most grain
+// iterations each. A grain of 0 picks about 8 chunks per worker.
+void
+parallel_for(int lo, int hi, int grain, void (*body)(int lo, int hi, void *arg), void *arg)
+{
+  struct range r;
+  int n = nworkers > 0 ? nworkers : 1;
+
+  if(hi <= lo)
+    return;
+  if(grain <= 0)
+    grain = (hi - lo) / (8 * n);
+  if(grain < 1)
+    grain = 1;
+  r.lo = lo;
+  r.hi = hi;
+  r.grain = grain;
+  r.body = body;
+  r.arg = arg;
+  range_task(&r);
+}
@@ -0,0 +1,27 @@
+// Work-stealing task runtime (task.c).
+//
+// task_init() starts one worker LWP per CPU (the caller becomes worker 0).
+// Each worker owns a Chase-Lev deque: it pushes and pops spawned tasks at
+// the bottom, and idle workers steal from the top of a victim's deque.
+// Workers that find nothing to do sleep on a semaphore until new tasks
+// are spawned.
+//
+// A task_t and its taskgroup_t are provided by the caller, usually on the
+// stack; they must stay alive until sync() on the group returns.
+
+typedef struct task {
+  void (*fn)(void*);
+  void *arg;
+  struct taskgroup *group;
+} task_t;
+
+typedef struct taskgroup {
+  volatile int pending;   // Spawned tasks that have not finished yet.
+} taskgroup_t;
+
+int  task_init(int nworkers);   // 0 starts one worker per CPU.
+void task_exit(void);
+int  task_nworkers(void);
+void spawn(taskgroup_t*, task_t*, void (*fn)(void*), void *arg);
+void sync(taskgroup_t*);
+void parallel_for(int lo, int hi, int grain, void (*body)(int lo, int hi, void *arg), void *arg);
@@ -0,0 +1,106 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MAXTHREADS 8
+#define ROUNDS 1000
+
+barrier_t barrier;
+int nthreads;
+volatile int startTick, endTick;
+
+// Barrier built from a mutex, a condition variable and counters,
+// the way phases were synchronized before barrier_wait() existed.
+thread_mutex_t mutex;
+thread_cond_t cond;
+int arrived;
+int generation;
+
+void
+cond_barrier_wait(void)
+{
+  int gen;
+
+  Mutex_lock(&mutex);
+  gen = generation;
+  if(++arrived == nthreads) {
+    arrived = 0;
+    generation++;
+    Cond_broadcast(&cond);
+  } else {
+    while(gen == generation)
+      Cond_wait(&cond, &mutex);
+  }
+  Mutex_unlock(&mutex);
+}
+
+void *
+kernel_barrier_thread(void *arg)
+{
+  int id = (int)arg;
+
+  barrier_wait(&barrier);
+  if(id == 0)
+    startTick = uptime();
+  for(int i = 0; i < ROUNDS; ++i)
+    barrier_wait(&barrier);
+  if(id == 0)
+    endTick = uptime();
+  thread_exit(0);
+  return 0;
+}
+
+void *
+cond_barrier_thread(void *arg)
+{
+  int id = (int)arg;
+
+  cond_barrier_wait();
+  if(id == 0)
+    startTick = uptime();
+  for(int i = 0; i < ROUNDS; ++i)
+    cond_barrier_wait();
+  if(id == 0)
+    endTick = uptime();
+  thread_exit(0);
+  return 0;
+}
+
+int
+run(void *(*fn)(void *), int n)
+{
+  thread_t t[MAXTHREADS];
+  void *ret;
+
+  nthreads = n;
+  barrier_init(&barrier, n);
+  Mutex_init(&mutex);
+  Cond_init(&cond);
+  arrived = generation = 0;
+  for(int i = 0; i < n; ++i) {
+    if(thread_create(&t[i], fn, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < n; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  return endTick - startTick;
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "Ticks for %d barrier phases\n", ROUNDS);
+  printf(1, "threads\tbarrier_wait\tmutex+cond\n");
+  for(int n = 1; n <= MAXTHREADS; ++n) {
+    int k = run(kernel_barrier_thread, n);
+    int c = run(cond_barrier_thread, n);
+    printf(1, "%d\t%d\t\t%d\n", n, k, c);
+  }
+  exit();
+}
@@ -0,0 +1,118 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define N 8
+
+thread_mutex_t mutex;
+thread_cond_t cond;
+volatile int go;
+volatile int arrived;
+volatile int woken;
+int arrival[N];
+int wakeorder[N];
+
+void *
+waiter(void *arg)
+{
+  int id = (int)arg;
+
+  Mutex_lock(&mutex);
+  arrival[arrived++] = id;
+  while(!go)
+    Cond_wait(&cond, &mutex);
+  wakeorder[woken++] = id;
+  Mutex_unlock(&mutex);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+fifo_waiter(void *arg)
+{
+  int id = (int)arg;
+
+  Mutex_lock(&mutex);
+  arrival[arrived++] = id;
+  Cond_wait(&cond, &mutex);
+  wakeorder[woken++] = id;
+  Mutex_unlock(&mutex);
+  thread_exit(0);
+  return 0;
+}
+
+void
+start(void *(*fn)(void *), thread_t *t)
+{
+  Mutex_init(&mutex);
+  Cond_init(&cond);
+  go = arrived = woken = 0;
+  for(int i = 0; i < N; ++i) {
+    if(thread_create(&t[i], fn, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+    // Let each thread queue up before creating the next one.
+    while(arrived <= i)
+      sleep(1);
+  }
+  // Wait until the last thread is asleep on the condition.
+  while(cond.waiting_threads < N)
+    sleep(1);
+}
+
+void
+join(thread_t *t)
+{
+  void *ret;
+
+  for(int i = 0; i < N; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t[N];
+  int i, ok, r, startTick;
+
+  printf(1, "1. Cond_broadcast wakes every waiter\n");
+  start(waiter, t);
+  Mutex_lock(&mutex);
+  go = 1;
+  Cond_broadcast(&cond);
+  Mutex_unlock(&mutex);
+  join(t);
+  printf(1, "%s\n", woken == N ? "ok" : "failed");
+
+  printf(1, "2. Cond_signal wakes waiters in FIFO order\n");
+  start(fifo_waiter, t);
+  for(i = 0; i < N; ++i) {
+    Mutex_lock(&mutex);
+    Cond_signal(&cond);
+    Mutex_unlock(&mutex);
+    while(woken <= i)
+      sleep(1);
+  }
+  join(t);
+  ok = 1;
+  for(i = 0; i < N; ++i)
+    if(wakeorder[i] != arrival[i])
+      ok = 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "3. Cond_timedwait times out\n");
+  Mutex_init(&mutex);
+  Cond_init(&cond);
+  Mutex_lock(&mutex);
+  startTick = uptime();
+  r = Cond_timedwait(&cond, &mutex, 10);
+  Mutex_unlock(&mutex);
+  printf(1, "%s\n", (r < 0 && uptime() - startTick >= 10) ? "ok" : "failed");
+
+  exit();
+}
@@ -0,0 +1,185 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define N 16384
+#define FORKS 20
+
+int data[N];
+xem_t sem;
+thread_mutex_t mutex;
+thread_cond_t cond;
+barrier_t barrier;
+int ready, woken;
+
+// Each sleeper blocks on one kind of object until the main thread
+// lets it go, and then counts itself as woken.
+void *
+semsleeper(void *arg)
+{
+  // Wait up to 5 seconds for the main thread to post.
+  if(xem_timedwait(&sem, 500) == 0)
+    __sync_fetch_and_add(&woken, 1);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+mutexsleeper(void *arg)
+{
+  Mutex_lock(&mutex);
+  __sync_fetch_and_add(&woken, 1);
+  Mutex_unlock(&mutex);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+condsleeper(void *arg)
+{
+  Mutex_lock(&mutex);
+  while(!ready)
+    Cond_wait(&cond, &mutex);
+  __sync_fetch_and_add(&woken, 1);
+  Mutex_unlock(&mutex);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+barriersleeper(void *arg)
+{
+  if(barrier_wait(&barrier) >= 0)
+    __sync_fetch_and_add(&woken, 1);
+  thread_exit(0);
+  return 0;
+}
+
+int
+check(int base)
+{
+  for(int i = 0; i < N; ++i)
+    if(data[i] != base + i)
+      return 0;
+  return 1;
+}
+
+void
+fill(int base)
+{
+  for(int i = 0; i < N; ++i)
+    data[i] = base + i;
+}
+
+// Time FORKS forks of a process with mb megabytes of touched heap.
+int
+forktime(int mb)
+{
+  char *heap;
+  int startTick, ticks;
+
+  if((heap = sbrk(mb << 20)) == (char*)-1) {
+    printf(1, "panic at sbrk\n");
+    exit();
+  }
+  for(int i = 0; i < (mb << 20); i += 4096)
+    heap[i] = 1;
+  startTick = uptime();
+  for(int i = 0; i < FORKS; ++i) {
+    int pid = fork();
+    if(pid < 0) {
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  ticks = uptime() - startTick;
+  sbrk(-(mb << 20));
+  return ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], res[2], pid, ok;
+  thread_t t[4];
+  void *ret;
+  char c;
+
+  printf(1, "1. Parent and child see their own writes only\n");
+  fill(0);
+  if(pipe(fds) < 0 || pipe(res) < 0) {
+    printf(1, "panic at pipe\n");
+    exit();
+  }
+  if((pid = fork()) == 0) {
+    // Wait until the parent has written its copy.
+    read(fds[0], &c, 1);
+    ok = check(0);
+    fill(1000000);
+    c = ok && check(1000000);
+    write(res[1], &c, 1);
+    exit();
+  }
+  fill(2000000);
+  write(fds[1], "x", 1);
+  read(res[0], &c, 1);
+  wait();
+  ok = c && check(2000000);
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "2. The kernel writes a shared page\n");
+  fill(0);
+  if((pid = fork()) == 0) {
+    // read() fills data through the kernel, not through a user store.
+    c = read(fds[0], data, sizeof(int)) == sizeof(int) && data[0] == 42 && data[1] == 1;
+    write(res[1], &c, 1);
+    exit();
+  }
+  c = 42;
+  write(fds[1], &c, 1);
+  write(fds[1], "\0\0\0", 3);
+  read(res[0], &c, 1);
+  wait();
+  ok = c && check(0);
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "3. Forking while threads sleep on synchronization objects\n");
+  xem_init(&sem, 0);
+  Mutex_init(&mutex);
+  Cond_init(&cond);
+  barrier_init(&barrier, 2);
+  if(thread_create(&t[0], semsleeper, 0) < 0 ||
+     thread_create(&t[1], condsleeper, 0) < 0 ||
+     thread_create(&t[2], barriersleeper, 0) < 0) {
+    printf(1, "panic at thread create\n");
+    exit();
+  }
+  // Let the condition waiter give the mutex up before holding it here.
+  sleep(10);
+  Mutex_lock(&mutex);
+  if(thread_create(&t[3], mutexsleeper, 0) < 0) {
+    printf(1, "panic at thread create\n");
+    exit();
+  }
+  sleep(10);
+  if((pid = fork()) == 0)
+    exit();
+  wait();
+  xem_unlock(&sem);
+  ready = 1;
+  Cond_signal(&cond);
+  Mutex_unlock(&mutex);
+  barrier_wait(&barrier);
+  for(int i = 0; i < 4; ++i)
+    thread_join(t[i], &ret);
+  printf(1, "%s\n", woken == 4 ? "ok" : "failed");
+
+  printf(1, "4. Fork time by heap size\n");
+  printf(1, "MB\tticks for %d forks\n", FORKS);
+  for(int mb = 0; mb <= 16; mb = mb ? mb * 4 : 1)
+    printf(1, "%d\t%d\n", mb, forktime(mb));
+  exit();
+}
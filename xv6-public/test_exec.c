@@ -0,0 +1,79 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define ROUNDS 200
+
+int data = 7;
+int bss[2048];
+
+// Run this program again with args, and return what it wrote to fd
+// 3, or 0 if it wrote nothing.
+char
+runchild(char *arg)
+{
+  char *argv[] = { "test_exec", arg, 0 };
+  int fds[2];
+  char c = 0;
+
+  pipe(fds);
+  if(fork() == 0) {
+    close(3);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec("test_exec", argv);
+    exit();
+  }
+  close(fds[1]);
+  read(fds[0], &c, 1);
+  close(fds[0]);
+  wait();
+  return c;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *child[] = { "test_exec", "exit", 0 };
+  int ok, startTick;
+
+  if(argc > 1) {
+    if(strcmp(argv[1], "data") == 0) {
+      ok = data == 7;
+      for(int i = 0; i < 2048; ++i)
+        if(bss[i] != 0)
+          ok = 0;
+      data = 8;
+      bss[2047] = 1;
+      write(3, ok ? "y" : "n", 1);
+    } else if(strcmp(argv[1], "text") == 0) {
+      *(volatile char*)main = 0;    // Killed here
+      write(3, "y", 1);
+    }
+    exit();
+  }
+
+  printf(1, "1. Data and bss start out as in the file\n");
+  data = 9;
+  bss[0] = 9;
+  ok = runchild("data") == 'y' && runchild("data") == 'y';
+  ok = ok && data == 9 && bss[0] == 9 && bss[2047] == 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "2. Text is read-only (a trap is expected)\n");
+  printf(1, "%s\n", runchild("text") == 0 ? "ok" : "failed");
+
+  printf(1, "3. Running this program %d times\n", ROUNDS);
+  startTick = uptime();
+  for(int i = 0; i < ROUNDS; ++i) {
+    if(fork() == 0) {
+      exec("test_exec", child);
+      printf(1, "panic at exec\n");
+      exit();
+    }
+    wait();
+  }
+  printf(1, "fork+exec+exit: %d ticks\n", uptime() - startTick);
+  exit();
+}
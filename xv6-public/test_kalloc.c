@@ -0,0 +1,61 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MAXCPUS 8
+#define ROUNDS 300
+
+// Allocate and free kernel pages as fast as possible: every fork
+// builds a page table and a kernel stack, every pipe takes a page.
+void
+churn(void)
+{
+  int fds[2];
+
+  for(int i = 0; i < ROUNDS; ++i) {
+    int pid = fork();
+    if(pid < 0) {
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    wait();
+    if(pipe(fds) < 0) {
+      printf(1, "panic at pipe\n");
+      exit();
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ncpu, startTick;
+
+  ncpu = getncpu();
+  if(ncpu > MAXCPUS)
+    ncpu = MAXCPUS;
+  printf(1, "Ticks for %d fork+pipe rounds per process (^P shows the page caches)\n", ROUNDS);
+  printf(1, "procs\tticks\n");
+  for(int n = 1; n <= ncpu; ++n) {
+    startTick = uptime();
+    for(int i = 0; i < n; ++i) {
+      int pid = fork();
+      if(pid < 0) {
+        printf(1, "panic at fork\n");
+        exit();
+      }
+      if(pid == 0) {
+        churn();
+        exit();
+      }
+    }
+    for(int i = 0; i < n; ++i)
+      wait();
+    printf(1, "%d\t%d\n", n, uptime() - startTick);
+  }
+  exit();
+}
@@ -0,0 +1,74 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MB (1 << 20)
+#define NTHREADS 4
+
+char *heap;
+volatile int failed;
+
+// Each LWP touches its own quarter of a heap region nobody touched yet.
+void *
+toucher(void *arg)
+{
+  int id = (int)arg;
+
+  for(int i = id * MB; i < (id + 1) * MB; i += 4096) {
+    if(heap[i] != 0)
+      failed = 1;
+    heap[i] = id + 1;
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t[NTHREADS];
+  int startTick, ticks, fd;
+  char *p;
+  void *ret;
+
+  printf(1, "1. Growing the heap by 64MB only reserves it\n");
+  startTick = uptime();
+  for(int i = 0; i < 64; ++i)
+    if(sbrk(MB) == (char*)-1) {
+      printf(1, "panic at sbrk\n");
+      exit();
+    }
+  ticks = uptime() - startTick;
+  printf(1, "%d ticks\n", ticks);
+  sbrk(-64 * MB);
+
+  printf(1, "2. Pages are zero on first touch, also in LWPs\n");
+  failed = 0;
+  heap = sbrk(NTHREADS * MB);
+  for(int i = 0; i < NTHREADS; ++i) {
+    if(thread_create(&t[i], toucher, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < NTHREADS; ++i)
+    thread_join(t[i], &ret);
+  for(int i = 0; i < NTHREADS * MB; i += 4096)
+    if(heap[i] != i / MB + 1)
+      failed = 1;
+  printf(1, "%s\n", failed ? "failed" : "ok");
+
+  printf(1, "3. System calls on untouched pages\n");
+  p = sbrk(2 * 4096);
+  if((fd = open("README", 0)) < 0 || read(fd, p + 4000, 200) != 200 || p[4000] == 0) {
+    printf(1, "failed\n");
+    exit();
+  }
+  close(fd);
+  // A file name in a page the kernel reads first: the empty name.
+  p = sbrk(4096);
+  if((fd = open(p, 0)) >= 0)
+    close(fd);
+  printf(1, "%s\n", failed ? "failed" : "ok");
+  exit();
+}
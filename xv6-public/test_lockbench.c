@@ -0,0 +1,54 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "spinlock.h"
+
+#define MAXCPUS 8
+#define ITERS 200000
+
+// Time n processes hammering one kernel spinlock of the given kind.
+int
+run(int kind, int n, int *ok)
+{
+  int before, after, startTick, ticks;
+
+  before = lockbench(kind, 0);
+  startTick = uptime();
+  for(int i = 0; i < n; ++i) {
+    int pid = fork();
+    if(pid < 0) {
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if(pid == 0) {
+      lockbench(kind, ITERS);
+      exit();
+    }
+  }
+  for(int i = 0; i < n; ++i)
+    wait();
+  ticks = uptime() - startTick;
+  after = lockbench(kind, 0);
+  if(after - before != n * ITERS)
+    *ok = 0;
+  return ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ncpu, ok = 1;
+
+  ncpu = getncpu();
+  if(ncpu > MAXCPUS)
+    ncpu = MAXCPUS;
+  printf(1, "Ticks for %d acquire/release pairs per process\n", ITERS);
+  printf(1, "procs\tmcs\ttest-and-set\n");
+  for(int n = 1; n <= ncpu; ++n) {
+    int m = run(SPIN_MCS, n, &ok);
+    int t = run(SPIN_TAS, n, &ok);
+    printf(1, "%d\t%d\t%d\n", n, m, t);
+  }
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  exit();
+}
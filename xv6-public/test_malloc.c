@@ -0,0 +1,232 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define MAXTHREADS 8
+#define ROUNDS 2000
+#define BATCH 16
+
+// The allocator umalloc.c used to be: one K&R free list,
+// here behind a lock so that it can be called from several threads.
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+static volatile uint legacylock;
+
+void
+legacy_free_locked(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  legacy_free_locked((void*)(hp + 1));
+  return freep;
+}
+
+void*
+legacy_malloc_locked(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+void
+legacy_lock(void)
+{
+  while(xchg(&legacylock, 1) != 0)
+    yield();
+}
+
+void*
+legacy_malloc(uint n)
+{
+  void *p;
+
+  legacy_lock();
+  p = legacy_malloc_locked(n);
+  xchg(&legacylock, 0);
+  return p;
+}
+
+void
+legacy_free(void *p)
+{
+  legacy_lock();
+  legacy_free_locked(p);
+  xchg(&legacylock, 0);
+}
+
+void *(*alloc)(uint);
+void (*release)(void*);
+volatile int failed;
+
+// Allocate a batch of small blocks of mixed sizes, fill them,
+// check them and free them again.
+void *
+worker(void *arg)
+{
+  int id = (int)arg;
+  char *p[BATCH];
+  uint n[BATCH];
+
+  for(int rep = 0; rep < ROUNDS; ++rep) {
+    for(int i = 0; i < BATCH; ++i) {
+      n[i] = 8 + ((rep + i * 37) % 16) * 16;
+      if((p[i] = alloc(n[i])) == 0) {
+        failed = 1;
+        thread_exit(0);
+      }
+      memset(p[i], id + i, n[i]);
+    }
+    for(int i = 0; i < BATCH; ++i) {
+      if(p[i][0] != (char)(id + i) || p[i][n[i] - 1] != (char)(id + i))
+        failed = 1;
+      release(p[i]);
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// One round of worker(), in a thread of its own.
+void *
+shortworker(void *arg)
+{
+  char *p[BATCH];
+
+  for(int i = 0; i < BATCH; ++i)
+    if((p[i] = malloc(8 + i * 16)) == 0)
+      failed = 1;
+  for(int i = 0; i < BATCH; ++i)
+    free(p[i]);
+  thread_exit(0);
+  return 0;
+}
+
+// Heap growth over n threads that each allocate a little and exit.
+int
+churn(int n)
+{
+  thread_t t;
+  void *ret;
+  char *top = sbrk(0);
+
+  for(int i = 0; i < n; ++i) {
+    if(thread_create(&t, shortworker, 0) < 0 || thread_join(t, &ret) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  return (char*)sbrk(0) - top;
+}
+
+int
+run(int nthreads)
+{
+  thread_t t[MAXTHREADS];
+  void *ret;
+  int startTick;
+
+  startTick = uptime();
+  for(int i = 0; i < nthreads; ++i) {
+    if(thread_create(&t[i], worker, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < nthreads; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  return uptime() - startTick;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int m, l;
+
+  printf(1, "Ticks for %d rounds of %d malloc/free pairs per thread\n", ROUNDS, BATCH);
+  printf(1, "threads\tmalloc\tlegacy\n");
+  failed = 0;
+  for(int n = 1; n <= MAXTHREADS; n *= 2) {
+    alloc = malloc;
+    release = free;
+    m = run(n);
+    alloc = legacy_malloc;
+    release = legacy_free;
+    l = run(n);
+    printf(1, "%d\t%d\t%d\n", n, m, l);
+  }
+  printf(1, "%s\n", failed ? "failed" : "ok");
+
+  printf(1, "Heap growth over 200 threads that exit\n");
+  churn(10);
+  printf(1, "%s\n", churn(200) == 0 && !failed ? "ok" : "failed");
+  exit();
+}
@@ -0,0 +1,109 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+#define FILESIZE (16 * 4096 + 100)
+#define PASSES   50
+
+char buf[FILESIZE];
+
+char
+pattern(int i)
+{
+  return 'a' + (i + i / 4096) % 26;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, ok, startTick, sum;
+  char *p, *q;
+
+  unlink("mmapfile");
+  if((fd = open("mmapfile", O_CREATE | O_RDWR)) < 0) {
+    printf(1, "panic at open\n");
+    exit();
+  }
+  for(int i = 0; i < FILESIZE; ++i)
+    buf[i] = pattern(i);
+  if(write(fd, buf, FILESIZE) != FILESIZE) {
+    printf(1, "panic at write\n");
+    exit();
+  }
+
+  printf(1, "1. A shared read-only mapping shows the file, zeros past its end\n");
+  if((p = mmap(fd, 0, FILESIZE, PROT_READ, MAP_SHARED)) == 0) {
+    printf(1, "panic at mmap\n");
+    exit();
+  }
+  ok = 1;
+  for(int i = 0; i < FILESIZE; ++i)
+    if(p[i] != pattern(i))
+      ok = 0;
+  for(int i = FILESIZE; i < 17 * 4096; ++i)
+    if(p[i] != 0)
+      ok = 0;
+  // It is read-only, so read() may not fill it.
+  if(read(fd, p, 10) >= 0)
+    ok = 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "2. Private writes stay private\n");
+  if((q = mmap(fd, 4096, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE)) == 0) {
+    printf(1, "panic at mmap\n");
+    exit();
+  }
+  q[10] = '#';
+  pread(fd, buf, 1, 4096 + 10);
+  ok = q[10] == '#' && p[4096 + 10] == pattern(4096 + 10) && buf[0] == pattern(4096 + 10);
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  munmap(q, 4096);
+
+  printf(1, "3. Shared writes reach other mappings, children and the file\n");
+  if((q = mmap(fd, 0, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED)) == 0) {
+    printf(1, "panic at mmap\n");
+    exit();
+  }
+  q[5] = '!';
+  ok = p[5] == '!';
+  if(fork() == 0) {
+    q[8 * 4096] = '?';
+    exit();
+  }
+  wait();
+  if(p[8 * 4096] != '?')
+    ok = 0;
+  msync(q, FILESIZE);
+  pread(fd, buf, 1, 5);
+  pread(fd, buf + 1, 1, 8 * 4096);
+  if(buf[0] != '!' || buf[1] != '?')
+    ok = 0;
+  pwrite(fd, "+", 1, 6);
+  if(q[6] != '+')
+    ok = 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  munmap(q, FILESIZE);
+
+  printf(1, "4. Reading the file %d times\n", PASSES);
+  startTick = uptime();
+  sum = 0;
+  for(int n = 0; n < PASSES; ++n) {
+    pread(fd, buf, FILESIZE, 0);
+    for(int i = 0; i < FILESIZE; i += 64)
+      sum += buf[i];
+  }
+  printf(1, "read(): %d ticks\n", uptime() - startTick);
+  startTick = uptime();
+  for(int n = 0; n < PASSES; ++n)
+    for(int i = 0; i < FILESIZE; i += 64)
+      sum -= p[i];
+  printf(1, "mmap(): %d ticks\n", uptime() - startTick);
+  printf(1, "%s\n", sum == 0 ? "ok" : "failed");
+
+  munmap(p, FILESIZE);
+  close(fd);
+  unlink("mmapfile");
+  exit();
+}
@@ -0,0 +1,67 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+thread_mutex_t mutex;
+volatile int counter;
+int work;
+
+#define N 8
+#define REP 200
+
+void *
+worker(void *arg)
+{
+  for(int rep = 0; rep < REP; ++rep) {
+    Mutex_lock(&mutex);
+    int tmp = counter;
+    // Do something inside the critical section.
+    volatile int n = 0;
+    while(++n < work);
+    counter = tmp + 1;
+    Mutex_unlock(&mutex);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void
+run(char *name, int w)
+{
+  thread_t t[N];
+  void *ret;
+  int start;
+
+  Mutex_init(&mutex);
+  counter = 0;
+  work = w;
+  start = uptime();
+  for(int i = 0; i < N; ++i) {
+    if(thread_create(&t[i], worker, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < N; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  printf(1, "%s: %d ticks, spins %d, blocks %d\n",
+         name, uptime() - start, mutex.spins, mutex.blocks);
+  if(counter != N * REP)
+    printf(1, "Race detected: counter %d, expected %d\n", counter, N * REP);
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "1. Short critical sections (expect mostly spins)\n");
+  run("short", 100);
+
+  printf(1, "2. Long critical sections (expect mostly blocks)\n");
+  run("long", 1000000);
+
+  exit();
+}
@@ -0,0 +1,88 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define ROUNDS 2000
+
+int
+main(int argc, char *argv[])
+{
+  xem_t *a, *b, *ping, *pong, *done;
+  rwlock_t *rw;
+  int fds[2], fds2[2], pid, startTick, ticks, ok;
+  char c;
+
+  printf(1, "1. Lookup by name\n");
+  a = xem_open("test1", 0);
+  b = xem_open("test1", 5);
+  ok = a != 0 && a == b && a->value == 0 && rwlock_open("test1", RWLOCK_READER_PREF) == 0;
+  ok = ok && sync_unlink("test1") == 0 && sync_unlink("test1") < 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "2. Ping-pong between two processes, %d rounds\n", ROUNDS);
+  ping = xem_open("ping", 0);
+  pong = xem_open("pong", 0);
+  if(ping == 0 || pong == 0 || pipe(fds) < 0 || pipe(fds2) < 0) {
+    printf(1, "panic at open\n");
+    exit();
+  }
+  startTick = uptime();
+  if((pid = fork()) == 0) {
+    // The child may use the inherited pointers or look the names up again.
+    if(xem_open("pong", 0) != pong)
+      printf(1, "failed: child sees another semaphore\n");
+    for(int i = 0; i < ROUNDS; ++i) {
+      xem_wait(ping);
+      xem_unlock(pong);
+    }
+    exit();
+  }
+  for(int i = 0; i < ROUNDS; ++i) {
+    xem_unlock(ping);
+    xem_wait(pong);
+  }
+  wait();
+  ticks = uptime() - startTick;
+  printf(1, "semaphores: %d ticks\n", ticks);
+
+  startTick = uptime();
+  if((pid = fork()) == 0) {
+    for(int i = 0; i < ROUNDS; ++i) {
+      read(fds[0], &c, 1);
+      write(fds2[1], &c, 1);
+    }
+    exit();
+  }
+  for(int i = 0; i < ROUNDS; ++i) {
+    write(fds[1], "x", 1);
+    read(fds2[0], &c, 1);
+  }
+  wait();
+  ticks = uptime() - startTick;
+  printf(1, "pipes: %d ticks\n", ticks);
+  sync_unlink("ping");
+  sync_unlink("pong");
+
+  printf(1, "3. A writer in one process blocks a reader in another\n");
+  rw = rwlock_open("rw", RWLOCK_WRITER_PREF);
+  done = xem_open("done", 0);
+  if(rw == 0 || done == 0) {
+    printf(1, "panic at open\n");
+    exit();
+  }
+  rwlock_acquire_writelock(rw);
+  if((pid = fork()) == 0) {
+    rwlock_acquire_readlock(rw);
+    xem_unlock(done);
+    rwlock_release_readlock(rw);
+    exit();
+  }
+  ok = xem_timedwait(done, 20) < 0;
+  rwlock_release_writelock(rw);
+  ok = ok && xem_timedwait(done, 500) == 0;
+  wait();
+  sync_unlink("rw");
+  sync_unlink("done");
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  exit();
+}
@@ -0,0 +1,84 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "x86.h"
+
+#define NTHREADS 8
+#define REP 200
+#define BLOCKS 32
+#define CHUNK 512
+
+int fd;
+uint maxlat[NTHREADS];
+uint totlat[NTHREADS];    // kcycles
+volatile int failed;
+
+// Read random chunks of the shared file, timing every pread.
+void *
+reader(void *arg)
+{
+  int id = (int)arg;
+  char buf[CHUNK];
+  uint seed = id * 7919 + 1;
+  unsigned long long t0, t;
+  int off;
+
+  for(int rep = 0; rep < REP; ++rep) {
+    seed = seed * 1103515245 + 12345;
+    off = ((seed >> 8) % BLOCKS) * CHUNK;
+    t0 = rdtsc();
+    if(pread(fd, buf, CHUNK, off) != CHUNK || buf[0] != (char)(off / CHUNK))
+      failed = 1;
+    t = rdtsc() - t0;
+    totlat[id] += t >> 10;
+    if((t >> 10) > maxlat[id])
+      maxlat[id] = t >> 10;
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t t[NTHREADS];
+  char buf[CHUNK];
+  uint tot = 0, max = 0;
+  void *ret;
+
+  if((fd = open("preadfile", O_CREATE | O_RDWR)) < 0) {
+    printf(1, "panic at open\n");
+    exit();
+  }
+  for(int i = 0; i < BLOCKS; ++i) {
+    memset(buf, i, CHUNK);
+    if(write(fd, buf, CHUNK) != CHUNK) {
+      printf(1, "panic at write\n");
+      exit();
+    }
+  }
+
+  printf(1, "%d threads x %d preads of one file\n", NTHREADS, REP);
+  for(int i = 0; i < NTHREADS; ++i) {
+    if(thread_create(&t[i], reader, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < NTHREADS; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+    tot += totlat[i];
+    if(maxlat[i] > max)
+      max = maxlat[i];
+  }
+  printf(1, "mean %d kcycles, max %d kcycles per pread\n",
+         tot / (NTHREADS * REP), max);
+  printf(1, "%s\n", failed ? "failed" : "ok");
+  close(fd);
+  unlink("preadfile");
+  exit();
+}
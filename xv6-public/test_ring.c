@@ -0,0 +1,147 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "ring.h"
+
+#define MAXTHREADS 8
+#define ITEMS 40000
+#define QSIZE 256
+
+enum { SPSC, MPMC, LOCKED };
+
+// The old way: a bounded buffer guarded by semaphores,
+// with a system call for every lock operation.
+struct locked {
+  xem_t mutex, items, slots;
+  uint head, tail;
+  void *slot[QSIZE];
+};
+
+struct spsc spsc;
+void *spscslot[QSIZE];
+struct mpmc mpmc;
+struct mpmc_cell mpmccell[QSIZE];
+struct locked locked;
+
+int kind, nprod, ncons;
+uint sums[MAXTHREADS];
+
+void
+locked_put(struct locked *q, void *v)
+{
+  xem_wait(&q->slots);
+  xem_wait(&q->mutex);
+  q->slot[q->tail++ % QSIZE] = v;
+  xem_unlock(&q->mutex);
+  xem_unlock(&q->items);
+}
+
+void*
+locked_get(struct locked *q)
+{
+  void *v;
+
+  xem_wait(&q->items);
+  xem_wait(&q->mutex);
+  v = q->slot[q->head++ % QSIZE];
+  xem_unlock(&q->mutex);
+  xem_unlock(&q->slots);
+  return v;
+}
+
+void *
+producer(void *arg)
+{
+  int id = (int)arg;
+
+  for(int i = id; i < ITEMS; i += nprod) {
+    void *v = (void*)(i + 1);
+    if(kind == SPSC)
+      spsc_put(&spsc, v);
+    else if(kind == MPMC)
+      mpmc_put(&mpmc, v);
+    else
+      locked_put(&locked, v);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+consumer(void *arg)
+{
+  int id = (int)arg;
+  uint v, sum = 0;
+
+  // Consumer id takes its share of the items, whoever produced them.
+  for(int i = id; i < ITEMS; i += ncons) {
+    if(kind == SPSC)
+      v = (uint)spsc_get(&spsc);
+    else if(kind == MPMC)
+      v = (uint)mpmc_get(&mpmc);
+    else
+      v = (uint)locked_get(&locked);
+    sum += v;
+  }
+  sums[id] = sum;
+  thread_exit(0);
+  return 0;
+}
+
+// Pass ITEMS items from n/2 producers to n/2 consumers.
+int
+run(int k, int n, int *ok)
+{
+  thread_t t[MAXTHREADS];
+  int startTick, ticks;
+  uint sum = 0;
+  void *ret;
+
+  kind = k;
+  nprod = ncons = n / 2;
+  spsc_init(&spsc, spscslot, QSIZE);
+  mpmc_init(&mpmc, mpmccell, QSIZE);
+  locked.head = locked.tail = 0;
+  xem_init(&locked.mutex, 1);
+  xem_init(&locked.items, 0);
+  xem_init(&locked.slots, QSIZE);
+
+  startTick = uptime();
+  for(int i = 0; i < n; ++i) {
+    if(thread_create(&t[i], i < nprod ? producer : consumer,
+                     (void*)(i < nprod ? i : i - nprod)) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < n; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  ticks = uptime() - startTick;
+  for(int i = 0; i < ncons; ++i)
+    sum += sums[i];
+  if(sum != (uint)ITEMS * (ITEMS + 1) / 2)
+    *ok = 0;
+  return ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ok = 1;
+
+  printf(1, "Ticks to pass %d items through a %d slot queue\n", ITEMS, QSIZE);
+  printf(1, "spsc, 1 producer and 1 consumer: %d\n", run(SPSC, 2, &ok));
+  printf(1, "threads\tmpmc\tsemaphores\n");
+  for(int n = 2; n <= MAXTHREADS; n += 2) {
+    int m = run(MPMC, n, &ok);
+    int l = run(LOCKED, n, &ok);
+    printf(1, "%d\t%d\t%d\n", n, m, l);
+  }
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  exit();
+}
@@ -20,11 +20,12 @@ void * writer2_with_rwlock(void *arg);
 
 void test1(void);
 void test2(void);
+void test3(void);
 
 int
 main(int argc, char *argv[])
 {
-  xem_init(&sem);
+  xem_init(&sem, 1);
   rwlock_init(&rwlock);
 
   /* TEST for checking lock acquisition order */
@@ -33,6 +34,9 @@ main(int argc, char *argv[])
   /* TEST for efficiency of performance of RW lock */
   test2();
 
+  /* TEST for writer waiting time under each policy */
+  test3();
+
   exit();
 }
 
@@ -110,6 +114,37 @@ test2(void)
   printf(1, "\tWriter Elapsed Ticks 2-a) %d ticks\t2-b) %d ticks\n", writerResults[0], writerResults[1]);
 }
 
+void
+test3(void)
+{
+  char *names[] = { "reader-preferring", "writer-preferring", "phase-fair" };
+  thread_t t[NTHREADS];
+  void *ret;
+
+  printf(1, "3. Waiting time per policy\n");
+  for(int mode = RWLOCK_READER_PREF; mode <= RWLOCK_PHASE_FAIR; ++mode) {
+    rwlock_init_mode(&rwlock, mode);
+    readerElapsedTicks = 0;
+    writerElapsedTicks = 0;
+    for(int i = 0; i < NTHREADS; ++i) {
+      void* (*start_routine)(void *) = i >= READERS_RATIO * NTHREADS ? writer2_with_rwlock : reader2_with_rwlock;
+      if(thread_create(&t[i], start_routine, (void *)(i)) < 0) {
+        printf(1, "panic at thread create\n");
+        exit();
+      }
+    }
+    for(int i = 0; i < NTHREADS; ++i) {
+      if(thread_join(t[i], &ret) < 0) {
+        printf(1, "panic at thread join\n");
+        exit();
+      }
+    }
+    printf(1, "\t%s: reader %d ticks, writer %d ticks\n", names[mode], readerElapsedTicks, writerElapsedTicks);
+    printf(1, "\t\treaders waited %d times, %d ticks, max %d\n", rwlock.rwaits, rwlock.rwaitticks, rwlock.rmaxwait);
+    printf(1, "\t\twriters waited %d times, %d ticks, max %d\n", rwlock.wwaits, rwlock.wwaitticks, rwlock.wmaxwait);
+  }
+}
+
 void *
 reader_with_rwlock(void *arg)
 {
@@ -4,6 +4,14 @@
 
 xem_t sem;
 
+#define QSIZE 4
+#define ITEMS 200
+xem_t slots, items, qlock;
+int queue[QSIZE];
+int head, tail;
+volatile int consumed;
+volatile int released;
+
 void *
 test_without_sem(void *arg)
 {
@@ -26,6 +34,43 @@ test_with_sem(void *arg)
   return 0;
 }
 
+void *
+producer(void *arg)
+{
+  for(int i = 1; i <= ITEMS; ++i) {
+    xem_wait(&slots);
+    xem_wait(&qlock);
+    queue[tail++ % QSIZE] = i;
+    xem_unlock(&qlock);
+    xem_unlock(&items);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+consumer(void *arg)
+{
+  for(int i = 0; i < ITEMS / 2; ++i) {
+    xem_wait(&items);
+    xem_wait(&qlock);
+    consumed += queue[head++ % QSIZE];
+    xem_unlock(&qlock);
+    xem_unlock(&slots);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+gate_waiter(void *arg)
+{
+  xem_wait(&sem);
+  __sync_add_and_fetch(&released, 1);
+  thread_exit(0);
+  return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -49,7 +94,7 @@ main(int argc, char *argv[])
   printf(1, "\nIts sequence could be mixed\n");
 
   printf(1, "2. Test with synchronization of a binary semaphore\n");
-  xem_init(&sem);
+  xem_init(&sem, 1);
   xem_wait(&sem);
   for(int i = 0; i < N; ++i) {
     if(thread_create(&t[i], test_with_sem, (void*)(i)) < 0) {
@@ -67,8 +112,7 @@ main(int argc, char *argv[])
   printf(1, "\nIts sequence must be sorted\n");
 
   printf(1, "3. Test with synchronization of a semaphore with 3 users\n");
-  xem_init(&sem);
-  sem.value = 3;
+  xem_init(&sem, 3);
   xem_wait(&sem);
   for(int i = 0; i < N; ++i) {
     if(thread_create(&t[i], test_with_sem, (void*)(i)) < 0) {
@@ -84,5 +128,54 @@ main(int argc, char *argv[])
     }
   }
   printf(1, "\nIts sequence could be messy\n");
+
+  printf(1, "4. Bounded queue with counting semaphores\n");
+  xem_init(&slots, QSIZE);
+  xem_init(&items, 0);
+  xem_init(&qlock, 1);
+  head = tail = consumed = 0;
+  for(int i = 0; i < 3; ++i) {
+    if(thread_create(&t[i], i == 0 ? producer : consumer, 0) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < 3; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  printf(1, "%s\n", consumed == ITEMS * (ITEMS + 1) / 2 ? "ok" : "failed");
+
+  printf(1, "5. xem_trywait and xem_timedwait do not block\n");
+  xem_init(&sem, 1);
+  int startTick = uptime();
+  int ok = xem_trywait(&sem) == 0 && xem_trywait(&sem) < 0 &&
+           xem_timedwait(&sem, 5) < 0 && uptime() - startTick >= 5;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "6. xem_post_n releases n waiters at once\n");
+  xem_init(&sem, 0);
+  released = 0;
+  for(int i = 0; i < N; ++i) {
+    if(thread_create(&t[i], gate_waiter, 0) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  while(sem.waiting < N)
+    sleep(1);
+  xem_post_n(&sem, N / 2);
+  sleep(5);
+  ok = released == N / 2;
+  xem_post_n(&sem, N - N / 2);
+  for(int i = 0; i < N; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  printf(1, "%s\n", ok && released == N ? "ok" : "failed");
   exit();
 }
\ No newline at end of file
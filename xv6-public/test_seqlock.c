@@ -0,0 +1,132 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "seqlock.h"
+
+#define NREADERS 7
+#define READS 20000
+#define WRITES 2000
+
+// Shared statistics block: b is always 2 * a and c is always a + b.
+struct stats {
+  uint a, b, c;
+} stats;
+
+seqlock_t seqlock;
+rwlock_t rwlock;
+volatile int failed;
+volatile int retries;
+
+void *
+seq_reader(void *arg)
+{
+  struct stats s;
+  uint seq;
+  int n = 0;
+
+  for(int i = 0; i < READS; ++i) {
+    do {
+      seq = read_seqbegin(&seqlock);
+      s = stats;
+      n++;
+    } while(read_seqretry(&seqlock, seq));
+    if(s.b != 2 * s.a || s.c != s.a + s.b)
+      failed = 1;
+  }
+  __sync_add_and_fetch(&retries, n - READS);
+  thread_exit(0);
+  return 0;
+}
+
+void *
+seq_writer(void *arg)
+{
+  for(int i = 0; i < WRITES; ++i) {
+    seqlock_write_lock(&seqlock);
+    stats.a++;
+    stats.b = 2 * stats.a;
+    stats.c = stats.a + stats.b;
+    seqlock_write_unlock(&seqlock);
+    if(i % 100 == 0)
+      yield();
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+rw_reader(void *arg)
+{
+  struct stats s;
+
+  for(int i = 0; i < READS; ++i) {
+    rwlock_acquire_readlock(&rwlock);
+    s = stats;
+    rwlock_release_readlock(&rwlock);
+    if(s.b != 2 * s.a || s.c != s.a + s.b)
+      failed = 1;
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *
+rw_writer(void *arg)
+{
+  for(int i = 0; i < WRITES; ++i) {
+    rwlock_acquire_writelock(&rwlock);
+    stats.a++;
+    stats.b = 2 * stats.a;
+    stats.c = stats.a + stats.b;
+    rwlock_release_writelock(&rwlock);
+    if(i % 100 == 0)
+      yield();
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+run(void *(*reader)(void *), void *(*writer)(void *))
+{
+  thread_t t[NREADERS + 1];
+  void *ret;
+  int startTick;
+
+  stats.a = stats.b = stats.c = 0;
+  startTick = uptime();
+  for(int i = 0; i <= NREADERS; ++i) {
+    if(thread_create(&t[i], i == 0 ? writer : reader, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i <= NREADERS; ++i) {
+    if(thread_join(t[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  return uptime() - startTick;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int s, r;
+
+  seqlock_init(&seqlock);
+  rwlock_init(&rwlock);
+  failed = retries = 0;
+
+  printf(1, "1. Readers see consistent snapshots\n");
+  s = run(seq_reader, seq_writer);
+  printf(1, "%s\n", failed ? "failed" : "ok");
+
+  printf(1, "2. Read cost against a readers-writer lock\n");
+  r = run(rw_reader, rw_writer);
+  printf(1, "\t%d readers x %d reads, %d writes\n", NREADERS, READS, WRITES);
+  printf(1, "\tseqlock %d ticks (%d retries)\trwlock %d ticks\n", s, retries, r);
+  printf(1, "%s\n", failed ? "failed" : "ok");
+  exit();
+}
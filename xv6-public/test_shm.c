@@ -0,0 +1,129 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define KEY     1234
+#define CHUNK   4096
+#define NSLOT   16
+#define NCHUNK  1024          // 4MB through each pipeline
+
+char chunk[CHUNK];
+
+uint
+consume(char *p)
+{
+  uint sum = 0;
+
+  for(int i = 0; i < CHUNK; i += 4)
+    sum += *(uint*)(p + i);
+  return sum;
+}
+
+void
+produce(char *p, int n)
+{
+  for(int i = 0; i < CHUNK; i += 4)
+    *(uint*)(p + i) = n + i;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int id, id2, fds[2], startTick, ok;
+  char *p, *q;
+  uint sum, want;
+  xem_t *full, *empty;
+
+  printf(1, "1. Children see a segment inherited across fork\n");
+  if((id = shmget(KEY, NSLOT * CHUNK)) < 0 || (p = shmat(id)) == 0) {
+    printf(1, "panic at shmget\n");
+    exit();
+  }
+  if(fork() == 0) {
+    for(int i = 0; i < NSLOT * CHUNK; i += CHUNK)
+      p[i] = i / CHUNK + 1;
+    exit();
+  }
+  wait();
+  ok = 1;
+  for(int i = 0; i < NSLOT * CHUNK; i += CHUNK)
+    if(p[i] != i / CHUNK + 1)
+      ok = 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+
+  printf(1, "2. Other processes find it by key\n");
+  if(fork() == 0) {
+    if((id2 = shmget(KEY, CHUNK)) != id || (q = shmat(id2)) == 0 || q == p)
+      exit();
+    q[1] = 'k';
+    shmdt(q);
+    exit();
+  }
+  wait();
+  printf(1, "%s\n", p[1] == 'k' ? "ok" : "failed");
+
+  printf(1, "3. Moving %d bytes between two processes\n", NCHUNK * CHUNK);
+  want = 0;
+  for(int n = 0; n < NCHUNK; ++n) {
+    produce(chunk, n);
+    want += consume(chunk);
+  }
+
+  pipe(fds);
+  startTick = uptime();
+  if(fork() == 0) {
+    close(fds[0]);
+    for(int n = 0; n < NCHUNK; ++n) {
+      produce(chunk, n);
+      write(fds[1], chunk, CHUNK);
+    }
+    exit();
+  }
+  close(fds[1]);
+  sum = 0;
+  for(int n = 0; n < NCHUNK; ++n) {
+    for(int got = 0, r; got < CHUNK; got += r)
+      if((r = read(fds[0], chunk + got, CHUNK - got)) <= 0) {
+        printf(1, "panic at read\n");
+        exit();
+      }
+    sum += consume(chunk);
+  }
+  wait();
+  close(fds[0]);
+  printf(1, "pipe: %d ticks\n", uptime() - startTick);
+  ok = sum == want;
+
+  sync_unlink("shmfull");
+  sync_unlink("shmempty");
+  full = xem_open("shmfull", 0);
+  empty = xem_open("shmempty", NSLOT);
+  startTick = uptime();
+  if(fork() == 0) {
+    for(int n = 0; n < NCHUNK; ++n) {
+      xem_wait(empty);
+      produce(p + (n % NSLOT) * CHUNK, n);
+      xem_unlock(full);
+    }
+    exit();
+  }
+  sum = 0;
+  for(int n = 0; n < NCHUNK; ++n) {
+    xem_wait(full);
+    sum += consume(p + (n % NSLOT) * CHUNK);
+    xem_unlock(empty);
+  }
+  wait();
+  printf(1, "shared memory: %d ticks\n", uptime() - startTick);
+  printf(1, "%s\n", ok && sum == want ? "ok" : "failed");
+  sync_unlink("shmfull");
+  sync_unlink("shmempty");
+
+  printf(1, "4. A removed segment lives on until detached\n");
+  shmrm(id);
+  ok = shmat(id) == 0;
+  p[0] = 'x';
+  ok = ok && p[0] == 'x' && shmdt(p) == 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  exit();
+}
@@ -0,0 +1,80 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NCHILD 12
+#define NPIPE  7        // Pipes per child: 2*NPIPE descriptors
+#define ROUNDS 2000
+
+// Hold more open files at once than the old fixed file table had (100).
+void
+manyfiles(void)
+{
+  int go[2], ready[2], fds[2];
+  char c;
+
+  if(pipe(go) < 0 || pipe(ready) < 0) {
+    printf(1, "panic at pipe\n");
+    exit();
+  }
+  for(int i = 0; i < NCHILD; ++i) {
+    int pid = fork();
+    if(pid < 0) {
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if(pid == 0) {
+      close(go[1]);
+      close(ready[0]);
+      for(int j = 0; j < NPIPE; ++j) {
+        if(pipe(fds) < 0) {
+          printf(1, "child %d: pipe %d failed\n", i, j);
+          break;
+        }
+      }
+      write(ready[1], "x", 1);
+      read(go[0], &c, 1);     // Keep them open until everyone is done
+      exit();
+    }
+  }
+  close(go[0]);
+  close(ready[1]);
+  for(int i = 0; i < NCHILD; ++i)
+    read(ready[0], &c, 1);
+  printf(1, "%d children hold %d pipe descriptors\n", NCHILD, NCHILD * NPIPE * 2);
+  close(go[1]);
+  for(int i = 0; i < NCHILD; ++i)
+    wait();
+  close(ready[0]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], fd, startTick;
+
+  manyfiles();
+
+  startTick = uptime();
+  for(int i = 0; i < ROUNDS; ++i) {
+    if(pipe(fds) < 0) {
+      printf(1, "panic at pipe\n");
+      exit();
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+  printf(1, "%d pipe+close: %d ticks\n", ROUNDS, uptime() - startTick);
+
+  startTick = uptime();
+  for(int i = 0; i < ROUNDS; ++i) {
+    if((fd = open("README", O_RDONLY)) < 0) {
+      printf(1, "panic at open\n");
+      exit();
+    }
+    close(fd);
+  }
+  printf(1, "%d open+close: %d ticks (^P shows the caches)\n", ROUNDS, uptime() - startTick);
+  exit();
+}
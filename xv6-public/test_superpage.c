@@ -0,0 +1,103 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MB      (1 << 20)
+#define SUPER   (4 * MB)
+#define HEAP    (64 * MB)
+#define NACCESS (4 * MB)
+
+// Grow the heap by n bytes starting on a 4MB boundary.
+char*
+alignedsbrk(int n)
+{
+  uint top = (uint)sbrk(0);
+
+  sbrk((SUPER - top % SUPER) % SUPER);
+  return sbrk(n);
+}
+
+// Touch every page of the heap, then read words at random in it.
+uint
+bench(char *heap, int *touchTicks, int *randomTicks)
+{
+  uint x = 2463534242, sum = 0;
+  int startTick;
+
+  startTick = uptime();
+  for(int i = 0; i < HEAP; i += 4096)
+    heap[i] = i / 4096;
+  *touchTicks = uptime() - startTick;
+
+  startTick = uptime();
+  for(int n = 0; n < NACCESS; ++n) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sum += heap[x % HEAP];
+  }
+  *randomTicks = uptime() - startTick;
+  return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *heap, *top;
+  int touchTicks, randomTicks, ok;
+  uint sums[2];
+
+  printf(1, "1. Touching and randomly reading %d MB of heap\n", HEAP / MB);
+  for(int on = 0; on <= 1; ++on) {
+    top = sbrk(0);
+    superpages(on);
+    if((heap = alignedsbrk(HEAP)) == (char*)-1) {
+      printf(1, "panic at sbrk\n");
+      exit();
+    }
+    sums[on] = bench(heap, &touchTicks, &randomTicks);
+    printf(1, "%s: touch %d ticks, random reads %d ticks\n",
+           on ? "4MB pages" : "4KB pages", touchTicks, randomTicks);
+    sbrk(top - (char*)sbrk(0));
+  }
+  printf(1, "%s\n", sums[0] == sums[1] ? "ok" : "failed");
+
+  printf(1, "2. Superpages are zero, and shared with children copy-on-write\n");
+  top = sbrk(0);
+  heap = alignedsbrk(2 * SUPER);
+  ok = 1;
+  for(int i = 0; i < 2 * SUPER; i += 512)
+    if(heap[i] != 0)
+      ok = 0;
+  heap[0] = 'p';
+  if(fork() == 0) {
+    heap[0] = 'c';
+    heap[SUPER + 8] = 'c';
+    exit();
+  }
+  wait();
+  if(heap[0] != 'p' || heap[SUPER + 8] != 0)
+    ok = 0;
+  heap[SUPER + 8] = 'p';
+  if(heap[SUPER + 8] != 'p')
+    ok = 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  sbrk(top - (char*)sbrk(0));
+
+  printf(1, "3. Shrinking the heap into a superpage keeps the rest\n");
+  top = sbrk(0);
+  heap = alignedsbrk(SUPER);
+  for(int i = 0; i < SUPER; i += 4096)
+    heap[i] = 1;
+  sbrk(-SUPER / 2);
+  ok = 1;
+  for(int i = 0; i < SUPER / 2; i += 4096)
+    if(heap[i] != 1)
+      ok = 0;
+  sbrk(SUPER / 2);
+  if(heap[SUPER / 2] != 0 || heap[SUPER - 1] != 0)
+    ok = 0;
+  printf(1, "%s\n", ok ? "ok" : "failed");
+  sbrk(top - (char*)sbrk(0));
+  exit();
+}
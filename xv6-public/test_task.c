@@ -0,0 +1,168 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "task.h"
+
+#define MAXWORKERS 8
+#define NSUM (1 << 16)
+#define SUMREP 200
+#define NSORT (1 << 15)
+#define SORTREP 4
+#define SORTCUT 64
+
+int *data;
+int *sorted;
+int *tmp;
+int partial[NSUM / 256];
+volatile int failed;
+
+void
+sum_body(int lo, int hi, void *arg)
+{
+  int s = 0;
+
+  for(int i = lo; i < hi; ++i)
+    s += data[i];
+  partial[lo / 256] = s;
+}
+
+// Sum the array with parallel_for, one chunk of 256 per partial sum.
+int
+parallel_sum(void)
+{
+  int s = 0;
+
+  parallel_for(0, NSUM, 256, sum_body, 0);
+  for(int i = 0; i < NSUM / 256; ++i)
+    s += partial[i];
+  return s;
+}
+
+struct sortarg {
+  int lo, hi;
+};
+
+void
+merge(int lo, int mid, int hi)
+{
+  int i = lo, j = mid, k = lo;
+
+  while(i < mid && j < hi)
+    tmp[k++] = sorted[i] <= sorted[j] ? sorted[i++] : sorted[j++];
+  while(i < mid)
+    tmp[k++] = sorted[i++];
+  while(j < hi)
+    tmp[k++] = sorted[j++];
+  memmove(sorted + lo, tmp + lo, (hi - lo) * sizeof(int));
+}
+
+void
+mergesort(void *arg)
+{
+  struct sortarg *a = arg;
+  struct sortarg left, right;
+  taskgroup_t group;
+  task_t t;
+  int i, j, x;
+
+  if(a->hi - a->lo <= SORTCUT) {
+    for(i = a->lo + 1; i < a->hi; ++i) {
+      x = sorted[i];
+      for(j = i; j > a->lo && sorted[j - 1] > x; --j)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = x;
+    }
+    return;
+  }
+  left.lo = a->lo;
+  left.hi = right.lo = a->lo + (a->hi - a->lo) / 2;
+  right.hi = a->hi;
+  group.pending = 0;
+  spawn(&group, &t, mergesort, &left);
+  mergesort(&right);
+  sync(&group);
+  merge(a->lo, left.hi, a->hi);
+}
+
+void
+parallel_sort(void)
+{
+  struct sortarg a;
+  uint seed = 12345;
+
+  for(int i = 0; i < NSORT; ++i) {
+    seed = seed * 1103515245 + 12345;
+    sorted[i] = (seed >> 8) % 100000;
+  }
+  a.lo = 0;
+  a.hi = NSORT;
+  mergesort(&a);
+  for(int i = 1; i < NSORT; ++i)
+    if(sorted[i - 1] > sorted[i])
+      failed = 1;
+}
+
+void
+print_speedup(int base, int t)
+{
+  int x;
+
+  if(t <= 0)
+    t = 1;
+  x = base * 100 / t;
+  printf(1, "%d.%d%d", x / 100, (x / 10) % 10, x % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ncpu, expect, startTick, sumTicks, sortTicks, sumBase = 0, sortBase = 0;
+
+  data = malloc(NSUM * sizeof(int));
+  sorted = malloc(NSORT * sizeof(int));
+  tmp = malloc(NSORT * sizeof(int));
+  if(data == 0 || sorted == 0 || tmp == 0) {
+    printf(1, "panic at malloc\n");
+    exit();
+  }
+  expect = 0;
+  for(int i = 0; i < NSUM; ++i) {
+    data[i] = i % 1000;
+    expect += data[i];
+  }
+
+  ncpu = getncpu();
+  if(ncpu > MAXWORKERS)
+    ncpu = MAXWORKERS;
+  printf(1, "workers\tsum ticks\tspeedup\tsort ticks\tspeedup\n");
+  failed = 0;
+  for(int n = 1; n <= ncpu; ++n) {
+    if(task_init(n) < 0) {
+      printf(1, "panic at task init\n");
+      exit();
+    }
+    startTick = uptime();
+    for(int rep = 0; rep < SUMREP; ++rep)
+      if(parallel_sum() != expect)
+        failed = 1;
+    sumTicks = uptime() - startTick;
+
+    startTick = uptime();
+    for(int rep = 0; rep < SORTREP; ++rep)
+      parallel_sort();
+    sortTicks = uptime() - startTick;
+    task_exit();
+
+    if(n == 1) {
+      sumBase = sumTicks;
+      sortBase = sortTicks;
+    }
+    printf(1, "%d\t%d\t\t", n, sumTicks);
+    print_speedup(sumBase, sumTicks);
+    printf(1, "\t%d\t\t", sortTicks);
+    print_speedup(sortBase, sortTicks);
+    printf(1, "\n");
+  }
+  printf(1, "%s\n", failed ? "failed" : "ok");
+  exit();
+}
@@ -0,0 +1,57 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "tls.h"
+
+#define N 8
+#define REP 1000
+
+thread_t tids[N];
+volatile int failed;
+
+void *
+worker(void *arg)
+{
+  int id = (int)arg;
+  struct tls *tls = thread_tls();
+
+  tls->data[0] = id;
+  for(int rep = 0; rep < REP; ++rep) {
+    // Other threads run in between; our block must be left alone.
+    if(thread_tls() != tls || tls->data[0] != id || thread_self() != tids[id])
+      failed = 1;
+    tls->data[1]++;
+    if(rep % 100 == 0)
+      yield();
+  }
+  if(tls->data[1] != REP)
+    failed = 1;
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  void *ret;
+
+  printf(1, "1. Manager process storage block\n");
+  printf(1, "%s\n", (thread_self() == 0 && thread_tls()->self == thread_tls()) ? "ok" : "failed");
+
+  printf(1, "2. Each LWP has its own storage block\n");
+  failed = 0;
+  for(int i = 0; i < N; ++i) {
+    if(thread_create(&tids[i], worker, (void*)i) < 0) {
+      printf(1, "panic at thread create\n");
+      exit();
+    }
+  }
+  for(int i = 0; i < N; ++i) {
+    if(thread_join(tids[i], &ret) < 0) {
+      printf(1, "panic at thread join\n");
+      exit();
+    }
+  }
+  printf(1, "%s\n", failed ? "failed" : "ok");
+  exit();
+}
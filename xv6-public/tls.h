@@ -0,0 +1,16 @@
+// Per-thread storage block.
+// Every process and LWP gets one at the top of its user stack
+// (see exec and thread_create), and its %gs segment starts at it,
+// so user code finds its own block with a single %gs-relative load.
+
+#define TLSSIZE 256    // Size of a thread storage block in bytes
+#define NMCLASS 14     // malloc size classes (umalloc.c)
+
+struct tls {
+  struct tls *self;    // Address of this block (%gs:0)
+  int tid;             // Thread ID, 0 for a manager process (%gs:4)
+  void *worker;        // Work-stealing runtime worker (task.c)
+  void *mcache[NMCLASS];   // malloc free lists per size class (umalloc.c)
+  ushort mcount[NMCLASS];  // Blocks on each list
+  uint data[(TLSSIZE - 12 - NMCLASS*6) / 4];  // Free for user programs
+};
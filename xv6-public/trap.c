@@ -7,11 +7,13 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "seqlock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
+seqlock_t tickseq;   // Lets uptime() read ticks without tickslock
 uint ticks;
 
 void
@@ -50,10 +52,12 @@ trap(struct trapframe *tf)
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
+      write_seqbegin(&tickseq);
       ticks++;
+      write_seqend(&tickseq);
       if(ticks % 200 == 0)
           priority_boost();         // Priority boost every 200 ticks.
-      wakeup(&ticks);
+      tickwakeup();
       release(&tickslock);
     }
     lapiceoi();
@@ -73,6 +77,30 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_TLBFLUSH:
+    lcr3(rcr3());
+    mycpu()->tlbflushes++;
+    lapiceoi();
+    break;
+  case T_PGFLT:
+    // Untouched pages fault on the first access, and copy-on-write
+    // pages on the first write. That goes for the kernel too when it
+    // copies to or from user memory: CR0_WP is set, so read-only PTEs
+    // hold in ring 0 as well, and uvmtouch() only gets the pages ready
+    // beforehand; another LWP can fork() and make them copy-on-write
+    // again while we sleep. A kernel fault can be handled only if no
+    // spinlock is held, i.e. interrupts were on. Then, as from user
+    // space, take interrupts again while pagefault() sleeps or waits
+    // for other CPUs. Read %cr2 first: another process may fault on
+    // this CPU meanwhile.
+    if(myproc() != 0 && ((tf->cs&3) == DPL_USER ||
+       (rcr2() < KERNBASE && (tf->eflags & FL_IF)))){
+      uint va = rcr2();
+      sti();
+      if(pagefault(va, tf->err) == 0)
+        break;
+    }
+    goto bad;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -82,6 +110,7 @@ trap(struct trapframe *tf)
 
   //PAGEBREAK: 13
   default:
+  bad:
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
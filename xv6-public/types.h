@@ -2,24 +2,46 @@ typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
 typedef uint pde_t;
+typedef uint pte_t;
 typedef int thread_t;
+// The kernel works on a synchronization object through the kernel
+// mapping of its page, so it may not straddle a page boundary. Each
+// type is aligned to its size rounded up to a power of two, which keeps
+// it within one page; objects from malloc() must be aligned by hand.
 typedef struct __thread_mutex_t {
-    int flag;
-} thread_mutex_t;
+    int flag;           // 0 if unlocked, otherwise 1 + process table slot of the owner.
+    int waiters;        // Number of LWPs sleeping on the mutex.
+    uint spins;         // Contended acquisitions that succeeded by spinning.
+    uint blocks;        // Contended acquisitions that had to sleep.
+} __attribute__((aligned(16))) thread_mutex_t;
 typedef struct __thread_cond_t {
     int waiting_threads;
-    thread_mutex_t lock;
-} thread_cond_t;
+    uint ticket;        // Last FIFO ticket handed to a waiter.
+} __attribute__((aligned(8))) thread_cond_t;
 typedef struct __xem_t {
-    int value;
-    thread_cond_t cond;
-    thread_mutex_t lock;
-} xem_t;
+    volatile int value;     // Units available.
+    volatile int waiting;   // Threads asleep in xem_wait() or xem_timedwait().
+    uint ticket;            // Last FIFO ticket handed to a waiter.
+} __attribute__((aligned(16))) xem_t;
+#define RWLOCK_READER_PREF 0   // Readers may always join other readers.
+#define RWLOCK_WRITER_PREF 1   // New readers wait while a writer is queued.
+#define RWLOCK_PHASE_FAIR  2   // Read and write phases alternate.
 typedef struct __rwlock_t {
-    xem_t lock;
-    xem_t writelock;
-    int readers;
-} rwlock_t;
+    volatile uint state;    // Writer bit, waiters bit and number of readers holding.
+    int mode;               // RWLOCK_READER_PREF, RWLOCK_WRITER_PREF or RWLOCK_PHASE_FAIR.
+    int rwaiting;           // Readers queued.
+    int wwaiting;           // Writers queued.
+    uint rticket;           // Last FIFO ticket handed to a reader.
+    uint wticket;           // Last FIFO ticket handed to a writer.
+    uint rwaits, wwaits;    // Acquisitions that had to wait.
+    uint rwaitticks, wwaitticks;  // Total ticks spent waiting.
+    uint rmaxwait, wmaxwait;      // Longest wait in ticks.
+} __attribute__((aligned(64))) rwlock_t;
+typedef struct __barrier_t {
+    int n;              // Number of participating LWPs.
+    int count;          // Number of LWPs that have arrived in the current phase.
+    uint generation;    // Incremented every time the barrier opens.
+} __attribute__((aligned(16))) barrier_t;
 typedef struct __thread_safe_guard {
     rwlock_t rwlock;
     int fd;
@@ -3,6 +3,8 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "tls.h"
+#include "seqlock.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -105,6 +107,29 @@ memmove(void *vdst, const void *vsrc, int n)
   return vdst;
 }
 
+void
+seqlock_init(seqlock_t *sl)
+{
+    sl->seq = 0;
+    sl->lock = 0;
+}
+
+// Take the writer side: wait for other writers, then start an update.
+void
+seqlock_write_lock(seqlock_t *sl)
+{
+    while(xchg(&sl->lock, 1) != 0)
+        yield();
+    write_seqbegin(sl);
+}
+
+void
+seqlock_write_unlock(seqlock_t *sl)
+{
+    write_seqend(sl);
+    xchg(&sl->lock, 0);
+}
+
 thread_safe_guard*
 thread_safe_guard_init(int fd)
 {
@@ -141,3 +166,22 @@ thread_safe_guard_destroy(thread_safe_guard* file_guard)
     file_guard = 0;
 }
 
+// Return the ID of the calling thread without entering the kernel.
+thread_t
+thread_self(void)
+{
+    thread_t tid;
+
+    asm volatile("movl %%gs:4, %0" : "=r" (tid));
+    return tid;
+}
+
+// Return the calling thread's storage block.
+struct tls*
+thread_tls(void)
+{
+    struct tls *tls;
+
+    asm volatile("movl %%gs:0, %0" : "=r" (tls));
+    return tls;
+}
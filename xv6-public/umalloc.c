@@ -2,8 +2,18 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "x86.h"
+#include "tls.h"
 
-// Memory allocator by Kernighan and Ritchie,
+// Memory allocator.
+//
+// Small requests are rounded up to one of NMCLASS size classes. Every
+// thread keeps a free list per class in its storage block, and only takes
+// the heap lock to move a batch of blocks between that list and the shared
+// lists. thread_exit() gives a thread's cached blocks back.
+//
+// Large requests, and the spans that small blocks are cut from, use the
+// allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
 
 typedef long Align;
@@ -18,11 +28,43 @@ union header {
 
 typedef union header Header;
 
+#define SMALL    0x80000000   // In s.size: a size class block, class in the low bits
+#define MAXCACHE 64           // Blocks a thread caches per class before giving half back
+#define SPANSIZE 8192         // Bytes cut into small blocks at a time
+#define MINGROW  8192         // Minimum heap growth in Header units
+#define LOCKSPIN 100          // Polls of a busy heap lock before yielding
+
+// Block sizes in bytes, header included.
+static const ushort classsize[NMCLASS] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
 static Header base;
 static Header *freep;
+static Header *central[NMCLASS];  // Shared free lists per class
+static volatile uint heaplock;
 
-void
-free(void *ap)
+static void
+lock(void)
+{
+  int i;
+
+  while(xchg(&heaplock, 1) != 0) {
+    for(i = 0; i < LOCKSPIN && heaplock; i++)
+      pause();
+    if(heaplock)
+      yield();
+  }
+}
+
+static void
+unlock(void)
+{
+  xchg(&heaplock, 0);
+}
+
+static void
+kr_free(void *ap)
 {
   Header *bp, *p;
 
@@ -43,25 +85,27 @@ free(void *ap)
   freep = p;
 }
 
+// Grow the heap by at least MINGROW units, so that sbrk
+// is called once for many small requests.
 static Header*
 morecore(uint nu)
 {
   char *p;
   Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
+  if(nu < MINGROW)
+    nu = MINGROW;
   p = sbrk(nu * sizeof(Header));
   if(p == (char*)-1)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  kr_free((void*)(hp + 1));
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+kr_malloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -88,3 +132,136 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// Move a batch of class c blocks from the shared list to the
+// thread's cache, cutting a new span if the shared list is empty.
+static int
+refill(struct tls *tls, int c)
+{
+  uint size = classsize[c];
+  int n, batch;
+  char *span;
+  Header *p;
+
+  batch = SPANSIZE / size;
+  if(batch > MAXCACHE / 2)
+    batch = MAXCACHE / 2;
+
+  lock();
+  if(central[c] == 0) {
+    if((span = kr_malloc(SPANSIZE)) == 0) {
+      unlock();
+      return -1;
+    }
+    for(n = SPANSIZE / size - 1; n >= 0; n--) {
+      p = (Header*)(span + n * size);
+      p->s.ptr = central[c];
+      central[c] = p;
+    }
+  }
+  for(n = 0; n < batch && central[c] != 0; n++) {
+    p = central[c];
+    central[c] = p->s.ptr;
+    p->s.ptr = tls->mcache[c];
+    tls->mcache[c] = p;
+  }
+  unlock();
+  tls->mcount[c] += n;
+  return 0;
+}
+
+// Give half of the thread's class c cache back to the shared list.
+static void
+flush(struct tls *tls, int c)
+{
+  Header *head, *tail;
+  int n;
+
+  head = tail = tls->mcache[c];
+  for(n = 1; n < MAXCACHE / 2; n++)
+    tail = tail->s.ptr;
+  tls->mcache[c] = tail->s.ptr;
+  tls->mcount[c] -= n;
+
+  lock();
+  tail->s.ptr = central[c];
+  central[c] = head;
+  unlock();
+}
+
+void
+free(void *ap)
+{
+  struct tls *tls;
+  Header *bp;
+  int c;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size & SMALL) {
+    c = bp->s.size & ~SMALL;
+    tls = thread_tls();
+    bp->s.ptr = tls->mcache[c];
+    tls->mcache[c] = bp;
+    if(++tls->mcount[c] > MAXCACHE)
+      flush(tls, c);
+    return;
+  }
+  lock();
+  kr_free(ap);
+  unlock();
+}
+
+void*
+malloc(uint nbytes)
+{
+  struct tls *tls;
+  Header *p;
+  void *ap;
+  int c;
+
+  if(nbytes + sizeof(Header) <= classsize[NMCLASS - 1]) {
+    for(c = 0; classsize[c] < nbytes + sizeof(Header); c++)
+      ;
+    tls = thread_tls();
+    if(tls->mcache[c] == 0 && refill(tls, c) < 0)
+      return 0;
+    p = tls->mcache[c];
+    tls->mcache[c] = p->s.ptr;
+    tls->mcount[c]--;
+    p->s.size = SMALL | c;
+    return (void*)(p + 1);
+  }
+  lock();
+  ap = kr_malloc(nbytes);
+  unlock();
+  return ap;
+}
+
+void _thread_exit(void*);
+
+// Exit the current thread, first giving its cached blocks back to the
+// shared lists. The next thread to get its stack slot starts with an
+// empty storage block, so they would be lost otherwise.
+void
+thread_exit(void *retval)
+{
+  struct tls *tls = thread_tls();
+  Header *tail;
+  int c;
+
+  lock();
+  for(c = 0; c < NMCLASS; c++) {
+    if(tls->mcache[c] == 0)
+      continue;
+    for(tail = tls->mcache[c]; tail->s.ptr != 0; tail = tail->s.ptr)
+      ;
+    tail->s.ptr = central[c];
+    central[c] = tls->mcache[c];
+    tls->mcache[c] = 0;
+    tls->mcount[c] = 0;
+  }
+  unlock();
+  _thread_exit(retval);
+}
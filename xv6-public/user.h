@@ -1,6 +1,9 @@
 struct stat;
 struct rtcdate;
 struct file;
+struct tls;
+struct seqlock;
+struct lockstat;
 
 // system calls
 int fork(void);
@@ -36,17 +39,39 @@ int TestAndSet(int*, int);
 void Cond_init(thread_cond_t*);
 void Cond_wait(thread_cond_t*, thread_mutex_t*);
 void Cond_signal(thread_cond_t*);
+void Cond_broadcast(thread_cond_t*);
+int Cond_timedwait(thread_cond_t*, thread_mutex_t*, int);
 void Mutex_init(thread_mutex_t*);
 void Mutex_lock(thread_mutex_t*);
 void Mutex_unlock(thread_mutex_t*);
-void xem_init(xem_t*);
-void xem_wait(xem_t*);
-void xem_unlock(xem_t*);
+int xem_init(xem_t*, int);
+int xem_wait(xem_t*);
+int xem_trywait(xem_t*);
+int xem_timedwait(xem_t*, int);
+int xem_post_n(xem_t*, int);
+int xem_unlock(xem_t*);
 int rwlock_init(rwlock_t*);
+int rwlock_init_mode(rwlock_t*, int);
+xem_t* xem_open(char*, int);
+rwlock_t* rwlock_open(char*, int);
+int sync_unlink(char*);
+void* mmap(int, int, int, int, int);
+int munmap(void*, int);
+int msync(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+int superpages(int);
+int lockbench(int, int);
+int lockstat(struct lockstat*, int, int);
 int rwlock_acquire_readlock(rwlock_t*);
 int rwlock_acquire_writelock(rwlock_t*);
 int rwlock_release_readlock(rwlock_t*);
 int rwlock_release_writelock(rwlock_t*);
+int barrier_init(barrier_t*, int);
+int barrier_wait(barrier_t*);
+int getncpu(void);
 int pread(int, void*, int, int);
 int pwrite(int, void*, int, int);
 
@@ -67,3 +92,8 @@ thread_safe_guard* thread_safe_guard_init(int);
 int thread_safe_pread(thread_safe_guard* file_guard, void* addr, int n, int off);
 int thread_safe_pwrite(thread_safe_guard* file_guard, void* addr, int n, int off);
 void thread_safe_guard_destroy(thread_safe_guard* file_guard);
+thread_t thread_self(void);
+struct tls* thread_tls(void);
+void seqlock_init(struct seqlock*);
+void seqlock_write_lock(struct seqlock*);
+void seqlock_write_unlock(struct seqlock*);
@@ -5,11 +5,14 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "traps.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+#define SUPERORDER 10  // SUPERPGSIZE == PGSIZE << SUPERORDER
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -29,23 +32,46 @@ seginit(void)
   lgdt(c->gdt, sizeof(c->gdt));
 }
 
+// Turn the superpage mapped by *pde into a page table of 4KB pages
+// that map the same memory with the same permissions. The TLB may
+// hold either translation meanwhile; they agree.
+static int
+splitpde(pde_t *pde)
+{
+  pte_t *pgtab;
+  uint pa;
+  int i;
+
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pa = PTE_ADDR(*pde);
+  ksplit(P2V(pa), SUPERORDER);
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i*PGSIZE) | (PTE_FLAGS(*pde) & ~PTE_PS);
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+// A superpage is split into 4KB pages first; callers on hot paths
+// look for superpages themselves to keep them.
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
   pde_t *pde;
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if((*pde & PTE_PS) && splitpde(pde) < 0)
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -57,7 +83,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -121,9 +147,8 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -173,6 +198,8 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  // %gs is reloaded from this descriptor when returning to user space.
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, p->tls, 0xffffffff, DPL_USER);
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
@@ -186,8 +213,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -224,20 +250,19 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > USERTOP)
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -255,6 +280,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
 
@@ -263,6 +289,16 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if((*pde & PTE_PS) && a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= oldsz){
+      // A whole superpage goes at once. (One that is only partly
+      // freed is split, or if memory for that runs out, left mapped
+      // until the whole address space goes.)
+      kfree_order(P2V(PTE_ADDR(*pde)), SUPERORDER);
+      *pde = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -270,8 +306,9 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+      // Shared pages belong to whoever mapped them in (syncobj.c).
+      if((*pte & PTE_SHARED) == 0)
+        kfree(P2V(pa));
       *pte = 0;
     }
   }
@@ -310,32 +347,79 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map a copy of the page that *pte maps at va in the child's page
+// table d, for a page that fork() must not share (see uvmsync()).
+int
+uvmcopypage(pde_t *d, uint va, pte_t *pte)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+  if(mappages(d, (void*)va, PGSIZE, V2P(mem), PTE_FLAGS(*pte) & ~PTE_D) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The pages themselves are not copied:
+// writable pages become read-only and copy-on-write in both
+// page tables, and cowpage() copies them when they are written.
+// Pages holding synchronization objects are copied now instead.
+// The caller must hold the parent's address space lock.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  uint pa, i;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    // Superpages are shared copy-on-write 4KB at a time.
+    if((pgdir[PDX(i)] & PTE_PS) && splitpde(&pgdir[PDX(i)]) < 0){
+      tlbshootdown(pgdir);
+      goto bad;
+    }
+    // Heap pages that were never touched are not there yet.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(*pte & PTE_SYNC){
+      if(uvmcopypage(d, i, pte) < 0){
+        tlbshootdown(pgdir);
+        goto bad;
+      }
+      continue;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0){
+      tlbshootdown(pgdir);
       goto bad;
     }
+    kref(P2V(pa));
+  }
+  // The parent's pages are read-only now; drop stale writable TLB entries.
+  tlbshootdown(pgdir);
+  // Shared mappings above USERTOP are inherited as they are.
+  for(i = USERTOP; i < KERNBASE; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P | PTE_SHARED)) != (PTE_P | PTE_SHARED))
+      continue;
+    if(mappages(d, (void*)i, PGSIZE, PTE_ADDR(*pte), PTE_FLAGS(*pte)) < 0)
+      goto bad;
   }
   return d;
 
@@ -344,33 +428,367 @@ bad:
   return 0;
 }
 
+// Give pgdir a private, writable copy of the copy-on-write page at va.
+// The page is only copied if another page table still maps it.
+// Returns 0 if va is writable now, -1 if it is not a copy-on-write
+// page or memory ran out. The caller must hold the address space lock.
+int
+cowpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *old, *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (char*)va, 0)) == 0 ||
+     (*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+    return -1;
+  if(*pte & PTE_W){
+    // Another LWP got here first; our TLB entry may be stale.
+    invlpg((char*)va);
+    return 0;
+  }
+  if((*pte & PTE_COW) == 0)
+    return -1;
+  old = P2V(PTE_ADDR(*pte));
+  if(krefcount(old) == 1){
+    // Everybody else has copied it already.
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+    invlpg((char*)va);
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, old, PGSIZE);
+  *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+  kfree(old);
+  // Other CPUs running LWPs of this process may still read the old page.
+  tlbshootdown(pgdir);
+  return 0;
+}
+
+// Size of the address space that p belongs to. Heap pages below it
+// are only allocated when first touched (see growproc).
+static uint
+heaptop(struct proc *p)
+{
+  return p->tid > 0 ? p->manager->sz : p->sz;
+}
+
+// Map a zeroed superpage over the 4MB region around va, if all of it
+// is heap that was never touched, none of it is mapped from a file,
+// and the buddy allocator has a block that size. The caller must hold the address space lock.
+static int
+lazysuperpage(struct proc *p, uint va)
+{
+  struct proc *mgr = p->tid > 0 ? p->manager : p;
+  pde_t *pde = &p->pgdir[PDX(va)];
+  uint base = va & ~(SUPERPGSIZE - 1);
+  char *mem;
+
+  if(!mgr->superpages || (*pde & PTE_P) || base + SUPERPGSIZE > heaptop(p) ||
+     mmapoverlap(p, base, SUPERPGSIZE))
+    return -1;
+  if((mem = kalloc_order(SUPERORDER)) == 0)
+    return -1;
+  memset(mem, 0, SUPERPGSIZE);
+  *pde = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  return 0;
+}
+
+// Map a zeroed page at va, which lies below the heap top but has not
+// been touched yet: a superpage if possible, else a 4KB page.
+// The caller must hold the address space lock.
+static int
+lazypage(struct proc *p, uint va)
+{
+  char *mem;
+
+  if(lazysuperpage(p, va) == 0)
+    return 0;
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(p->pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Turn superpages for new heap regions of the current process on or
+// off. Returns the old setting.
+int
+superpages(int on)
+{
+  struct proc *p = myproc();
+  int old;
+
+  if(on != 0 && on != 1)
+    return -1;
+  if(p->tid > 0)
+    p = p->manager;
+  acquirevm(p);
+  old = p->superpages;
+  p->superpages = on;
+  releasevm(p);
+  return old;
+}
+
+// Fill in the missing page at va: a page of a file mapping or of the
+// program image, or an untouched heap page.
+// The caller must hold the address space lock.
+static int
+fillpage(struct proc *p, uint va, int write)
+{
+  if(mmapped(p, va, 1))
+    return mmapfault(p, va, write);
+  if(va < heaptop(p))
+    return lazypage(p, va);
+  return -1;
+}
+
+// Does the kernel have to fix up the page at va before touching it?
+static int
+needtouch(pde_t *pgdir, uint va, int write)
+{
+  pte_t *pte;
+
+  // Superpages are always there and writable.
+  if(pgdir[PDX(va)] & PTE_PS)
+    return 0;
+  if((pte = walkpgdir(pgdir, (char*)va, 0)) == 0 || (*pte & PTE_P) == 0)
+    return 1;
+  return write && (*pte & PTE_W) == 0;
+}
+
+// Prepare [va, va+size) of the current process for the kernel to read,
+// or write if write is set, through the user mapping: fill in missing
+// pages and copy copy-on-write ones. trap() would do the same on the
+// kernel's first access (CR0_WP makes kernel writes honour read-only
+// PTEs), but this takes the address space lock once for the whole
+// range and fails cleanly, where a bad kernel access would panic.
+// Writing a page that is read-only for the process fails.
+// Called by argptr() and the fetch functions in syscall.c.
+int
+uvmtouch(uint va, uint size, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a;
+  int r = 0;
+
+  if(size == 0)
+    return 0;
+  for(a = PGROUNDDOWN(va); a < va + size; a += PGSIZE)
+    if(needtouch(p->pgdir, a, write))
+      break;
+  if(a >= va + size)
+    return 0;
+  acquirevm(p);
+  for(; a < va + size && r == 0; a += PGSIZE){
+    if(!needtouch(p->pgdir, a, write))
+      continue;
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0)
+      r = fillpage(p, a, write);
+    else
+      r = cowpage(p->pgdir, a);
+  }
+  releasevm(p);
+  return r;
+}
+
+// Is the page at va ready to hold a synchronization object?
+static int
+synced(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if(pgdir[PDX(va)] & PTE_PS)
+    return 0;
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  return pte != 0 && (*pte & (PTE_P | PTE_W | PTE_SYNC)) == (PTE_P | PTE_W | PTE_SYNC);
+}
+
+// Pin the object at [va, va+size) of the current process, a mutex,
+// condition variable, semaphore, rwlock or barrier, and return the
+// kernel address of it in *kva. The kernel updates these objects with
+// ptable.lock held, when it cannot take a page fault, so it works on
+// them through the kernel mapping of their page: that cannot fault,
+// even if another LWP unmaps the page or shrinks the heap meanwhile.
+// The page is made present and writable, split out of any superpage,
+// marked PTE_SYNC so that fork() copies it for the child at once
+// instead of sharing it copy-on-write, and given a reference that
+// the caller drops with kfree() once it is done with the object.
+// The object must not straddle a page boundary (see types.h).
+int
+uvmsync(uint va, uint size, char **kva)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a = PGROUNDDOWN(va);
+  char *ka;
+  int r = 0;
+
+  if(size == 0 || PGROUNDDOWN(va + size - 1) != a)
+    return -1;
+  acquirevm(p);
+  if(!synced(p->pgdir, a)){
+    if(needtouch(p->pgdir, a, 1)){
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+      if(pte == 0 || (*pte & PTE_P) == 0)
+        r = fillpage(p, a, 1);
+      else
+        r = cowpage(p->pgdir, a);
+    }
+    if(r == 0 && (pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0)
+      r = -1;
+    if(r == 0)
+      *pte |= PTE_SYNC;
+  }
+  if(r == 0 && (ka = uva2ka(p->pgdir, (char*)a)) == 0)
+    r = -1;
+  if(r == 0){
+    kref(ka);
+    *kva = ka + (va - a);
+  }
+  releasevm(p);
+  return r;
+}
+
+// Handle a page fault at va in the current process: allocate an
+// untouched heap page, read in a page of a file mapping, or copy a
+// copy-on-write page that is written.
+// Returns 0 if the faulting instruction can be restarted.
+int
+pagefault(uint va, uint err)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  int r = -1;
+
+  if(va >= KERNBASE)
+    return -1;
+  acquirevm(p);
+  if(p->pgdir[PDX(va)] & PTE_PS){
+    // Another LWP mapped a superpage here meanwhile.
+    releasevm(p);
+    return 0;
+  }
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte == 0 || (*pte & PTE_P) == 0){
+    // Another LWP may have mapped it meanwhile.
+    r = fillpage(p, va, err & FEC_WR);
+  } else if(err & FEC_WR)
+    r = cowpage(p->pgdir, va);
+  else
+    r = (*pte & PTE_U) ? 0 : -1;
+  releasevm(p);
+  return r;
+}
+
+// Make every CPU drop its TLB entries for pgdir, after PTEs of pgdir
+// lost permissions or changed pages. CPUs running a process with
+// another page table have nothing cached for it. Must be called with
+// interrupts enabled and no spinlock held: the other CPUs may be
+// waiting for us to take their own shootdowns.
+void
+tlbshootdown(pde_t *pgdir)
+{
+  struct cpu *c, *me;
+  struct proc *p;
+  uint seen[NCPU];
+  int sent[NCPU];
+
+  pushcli();
+  me = mycpu();
+  if(rcr3() == V2P(pgdir))
+    lcr3(V2P(pgdir));
+  for(c = cpus; c < cpus+ncpu; c++){
+    sent[c - cpus] = 0;
+    if(c != me && (p = c->proc) != 0 && p->pgdir == pgdir){
+      seen[c - cpus] = c->tlbflushes;
+      lapicipi(c->apicid, T_TLBFLUSH);
+      sent[c - cpus] = 1;
+    }
+  }
+  popcli();
+  // A CPU that switches to pgdir meanwhile loads the new entries anyway.
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(sent[c - cpus] && c->tlbflushes == seen[c - cpus])
+      pause();
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
+  pde_t pde;
   pte_t *pte;
 
+  pde = pgdir[PDX(uva)];
+  if((pde & (PTE_PS | PTE_U)) == (PTE_PS | PTE_U))
+    return (char*)P2V(PTE_ADDR(pde)) + PTX(uva)*PGSIZE;
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
+// Map the kernel page ka at user address va, shared with every other
+// address space that maps it. Does nothing if va already maps ka.
+int
+mapshared(pde_t *pgdir, uint va, char *ka)
+{
+  pte_t *pte;
+
+  if((pte = walkpgdir(pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P)){
+    if(PTE_ADDR(*pte) != V2P(ka))
+      return -1;
+    return 0;
+  }
+  return mappages(pgdir, (char*)va, PGSIZE, V2P(ka), PTE_W|PTE_U|PTE_SHARED);
+}
+
+// Return 1 if [va, va+size) is mapped user memory below KERNBASE.
+int
+uvmmapped(pde_t *pgdir, uint va, uint size)
+{
+  pte_t *pte;
+  uint a;
+
+  if(size == 0 || va + size < va || va + size > KERNBASE)
+    return 0;
+  for(a = PGROUNDDOWN(va); a < va + size; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS)
+      continue;
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+      return 0;
+  }
+  return 1;
+}
+
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Copy-on-write pages are copied first, so if pgdir is a live address
+// space that other LWPs use, its address space lock must be held.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
+  pte_t *pte;
   uint n, va0;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if((pgdir[PDX(va0)] & PTE_PS) == 0 &&
+       (pte = walkpgdir(pgdir, (char*)va0, 0)) != 0 && (*pte & PTE_COW) &&
+       cowpage(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
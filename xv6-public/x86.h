@@ -130,6 +130,52 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically replace *addr with newval if it equals oldval.
+// Returns the value *addr held before the operation.
+static inline uint
+cmpxchg(volatile uint *addr, uint oldval, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (oldval) :
+               "memory", "cc");
+  return result;
+}
+
+// Atomically add v to *addr. Returns the value *addr held before.
+static inline int
+fetch_add(volatile int *addr, int v)
+{
+  asm volatile("lock; xaddl %0, %1" : "+r" (v), "+m" (*addr) : : "memory", "cc");
+  return v;
+}
+
+// Full memory barrier: orders an earlier store before a later load.
+static inline void
+mfence(void)
+{
+  asm volatile("lock; addl $0, 0(%%esp)" : : : "memory", "cc");
+}
+
+// Read the time-stamp counter.
+static inline unsigned long long
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((unsigned long long)hi << 32) | lo;
+}
+
+// Hint to the processor that this is a spin-wait loop.
+static inline void
+pause(void)
+{
+  asm volatile("pause" : : : "memory");
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +190,21 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
+// Drop the TLB entry for the page containing va.
+static inline void
+invlpg(void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().